@@ -0,0 +1,1171 @@
+// Timings of the collision structures and entity storage of main.cpp, one
+// table per workload, mostly with enemies spread over the view and clumped on
+// one spot and up to constants::kEnemyShipCount of them.
+// Build from the SpaceWars directory with optimizations, e.g.
+//   g++ -std=c++20 -O2 -Iinclude bench/broadphase_bench.cpp
+#define SDL_MAIN_HANDLED
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "aabb_tree.h"
+#include "archetype_store.h"
+#include "component_pool.h"
+#include "components.h"
+#include "constants.h"
+#include "entity.h"
+#include "grid_tuner.h"
+#include "group_bvh.h"
+#include "morton_order.h"
+#include "narrowphase.h"
+#include "packed_grid.h"
+#include "pair_cache.h"
+#include "spatial_hash_grid.h"
+#include "sweep_and_prune.h"
+#include "system_scheduler.h"
+#include "worker_pool.h"
+#include "world_spatial_hash.h"
+
+namespace {
+constexpr int kFrameCount = 200;
+constexpr int kBulletCount = 300;
+constexpr float kDeltaTime = 1.f / 60.f;
+
+Position positions[constants::kEntityCount]{};
+Velocity velocities[constants::kEntityCount]{};
+
+struct Scene {
+  std::vector<entity::Entity> enemies;
+  std::vector<entity::Entity> bullets;
+  bool clumped = false;
+};
+
+// clumped enemies steer towards the center of the view like
+// UpdateEnemyVelocities does, spread ones drift across it and bounce off its
+// borders so they stay spread. bullets fly outwards from the center and
+// bounce the same way
+Scene CreateScene(int enemy_count, bool clumped,
+                  int bullet_count = kBulletCount) {
+  const float spread = clumped ? 0.1f : 1.f;
+  const float center_x = constants::kGameWidth / 2.f;
+  const float center_y = constants::kGameHeight / 2.f;
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> x_dist(
+      center_x * (1.f - spread), center_x * (1.f + spread));
+  std::uniform_real_distribution<float> y_dist(
+      center_y * (1.f - spread), center_y * (1.f + spread));
+  std::uniform_real_distribution<float> dir_dist(-1.f, 1.f);
+  Scene scene;
+  scene.clumped = clumped;
+  int id = 1;
+  for (int i = 0; i < enemy_count; i++, id++) {
+    scene.enemies.push_back({id, entity::Type::kEnemy});
+    positions[id] = {x_dist(rng), y_dist(rng)};
+    velocities[id] = {dir_dist(rng) * 100.f, dir_dist(rng) * 100.f};
+  }
+  for (int i = 0; i < bullet_count; i++, id++) {
+    scene.bullets.push_back({id, entity::Type::kBullet});
+    positions[id] = {center_x, center_y};
+    velocities[id] = {dir_dist(rng) * 200.f, dir_dist(rng) * 200.f};
+  }
+  return scene;
+}
+
+// moves a spread enemy or a bullet on and turns it around at the borders of
+// the view
+void Drift(Position& pos, Velocity& velocity) {
+  pos.x += velocity.x * kDeltaTime;
+  pos.y += velocity.y * kDeltaTime;
+  if ((pos.x < 0.f && velocity.x < 0.f) ||
+      (pos.x > constants::kGameWidth - 16.f && velocity.x > 0.f)) {
+    velocity.x = -velocity.x;
+  }
+  if ((pos.y < 0.f && velocity.y < 0.f) ||
+      (pos.y > constants::kGameHeight - 16.f && velocity.y > 0.f)) {
+    velocity.y = -velocity.y;
+  }
+}
+
+void Step(const Scene& scene) {
+  const float target_x = constants::kGameWidth / 2.f;
+  const float target_y = constants::kGameHeight / 2.f;
+  for (const auto& enemy : scene.enemies) {
+    auto& pos = positions[enemy.id];
+    if (!scene.clumped) {
+      Drift(pos, velocities[enemy.id]);
+      continue;
+    }
+    float x = target_x - pos.x;
+    float y = target_y - pos.y;
+    float length = math::GetMagnitude(x, y);
+    if (length < 6.f) {
+      continue;
+    }
+    pos.x += x / length * 100.f * kDeltaTime;
+    pos.y += y / length * 100.f * kDeltaTime;
+  }
+  // bullets bounce too, so the queries keep finding enemies however long a
+  // table runs
+  for (const auto& bullet : scene.bullets) {
+    Drift(positions[bullet.id], velocities[bullet.id]);
+  }
+}
+
+template <typename Grid>
+int QueryBullets(Grid& grid, const Scene& scene) {
+  int candidates = 0;
+  for (const auto& bullet : scene.bullets) {
+    const auto& pos = positions[bullet.id];
+    grid.ForEachNearbyEntityOfType(
+        entity::Type::kEnemy, pos.x, pos.y, pos.x + 16.f, pos.y + 16.f,
+        [&](const entity::Entity&) { candidates++; });
+  }
+  return candidates;
+}
+
+// returns the average milliseconds spent in frame, which does the broadphase
+// maintenance plus the bullet queries and returns the candidate count
+template <typename Frame>
+double Run(int enemy_count, bool clumped, Frame&& frame, int& checksum,
+           int frame_count = kFrameCount) {
+  const Scene scene = CreateScene(enemy_count, clumped);
+  std::chrono::duration<double, std::milli> elapsed{};
+  for (int frame_index = 0; frame_index < frame_count; frame_index++) {
+    Step(scene);
+    const auto start = std::chrono::steady_clock::now();
+    checksum += frame(scene);
+    elapsed += std::chrono::steady_clock::now() - start;
+  }
+  return elapsed.count() / frame_count;
+}
+
+// the broadphase modes of main.cpp for a growing number of enemies: the
+// incremental SpatialGrid, the PackedGrid rebuilt every frame, SweepAndPrune
+// with per-bullet queries and with its bullet/enemy pair sweep, and the
+// AabbTree
+void RunWorkload(bool clumped) {
+  static collision::SpatialGrid spatial_grid;
+  static collision::PackedGrid packed_grid;
+  static collision::SweepAndPrune sweep_and_prune;
+  static collision::AabbTree aabb_tree;
+
+  printf("%s enemies\n", clumped ? "clumped" : "spread");
+  printf("%8s %14s %14s %14s %14s %14s\n", "enemies", "incremental ms",
+         "rebuild ms", "sap query ms", "sap pairs ms", "aabb tree ms");
+  for (int enemy_count : {10, 25, 50, 100, 250, 500, 1000, 2000, 3000, 4000,
+                          constants::kEnemyShipCount}) {
+    spatial_grid.Clear();
+    packed_grid.Clear();
+    sweep_and_prune.Clear();
+    aabb_tree.Clear();
+    int checksum = 0;
+
+    const double incremental_ms = Run(
+        enemy_count, clumped,
+        [&](const Scene& scene) {
+          for (const auto& enemy : scene.enemies) {
+            spatial_grid.Update(enemy, positions[enemy.id].x,
+                                positions[enemy.id].y, 16.f, 16.f);
+          }
+          return QueryBullets(spatial_grid, scene);
+        },
+        checksum);
+    const double rebuild_ms = Run(
+        enemy_count, clumped,
+        [&](const Scene& scene) {
+          packed_grid.Rebuild(scene.enemies, positions, 16.f, 16.f);
+          return QueryBullets(packed_grid, scene);
+        },
+        checksum);
+    const double sap_query_ms = Run(
+        enemy_count, clumped,
+        [&](const Scene& scene) {
+          for (const auto& enemy : scene.enemies) {
+            sweep_and_prune.Update(enemy, positions[enemy.id].x,
+                                   positions[enemy.id].y, 16.f, 16.f);
+          }
+          return QueryBullets(sweep_and_prune, scene);
+        },
+        checksum);
+    sweep_and_prune.Clear();
+    const double sap_pairs_ms = Run(
+        enemy_count, clumped,
+        [&](const Scene& scene) {
+          for (const auto& enemy : scene.enemies) {
+            sweep_and_prune.Update(enemy, positions[enemy.id].x,
+                                   positions[enemy.id].y, 16.f, 16.f);
+          }
+          // bullet boxes match the query boxes of QueryBullets
+          for (const auto& bullet : scene.bullets) {
+            sweep_and_prune.Update(bullet, positions[bullet.id].x + 8.f,
+                                   positions[bullet.id].y + 8.f, 8.f, 8.f);
+          }
+          int candidates = 0;
+          sweep_and_prune.ForEachOverlappingPair(
+              entity::Type::kBullet, entity::Type::kEnemy,
+              [&](const entity::Entity&, const entity::Entity&) {
+                candidates++;
+              });
+          return candidates;
+        },
+        checksum);
+    const double aabb_tree_ms = Run(
+        enemy_count, clumped,
+        [&](const Scene& scene) {
+          for (const auto& enemy : scene.enemies) {
+            aabb_tree.Update(enemy, positions[enemy.id].x,
+                             positions[enemy.id].y, 16.f, 16.f);
+          }
+          return QueryBullets(aabb_tree, scene);
+        },
+        checksum);
+    printf("%8d %14.3f %14.3f %14.3f %14.3f %14.3f\n", enemy_count,
+           incremental_ms, rebuild_ms, sap_query_ms, sap_pairs_ms,
+           aabb_tree_ms);
+    // keeps the optimizer from dropping the queries
+    if (checksum == -1) {
+      printf("%d\n", checksum);
+    }
+  }
+}
+
+// per-bullet queries plus scalar rectangle tests against the
+// BatchedNarrowphase, over the same PackedGrid
+void RunNarrowphaseWorkload() {
+  static collision::PackedGrid packed_grid;
+  static collision::BatchedNarrowphase batched_narrowphase;
+  std::vector<entity::Entity> packed_entities;
+
+  printf("spread enemies, narrowphase\n");
+  printf("%8s %14s %14s %14s\n", "enemies", "per bullet ms", "batched ms",
+         "hits");
+  for (int enemy_count : {500, 1000, 2000, 3000, 4000,
+                          constants::kEnemyShipCount}) {
+    const Scene scene = CreateScene(enemy_count, false);
+    packed_entities = scene.enemies;
+    packed_entities.insert(packed_entities.end(), scene.bullets.begin(),
+                           scene.bullets.end());
+    std::chrono::duration<double, std::milli> per_bullet{};
+    std::chrono::duration<double, std::milli> batched{};
+    int per_bullet_hits = 0;
+    int batched_hits = 0;
+    for (int frame = 0; frame < kFrameCount; frame++) {
+      Step(scene);
+      packed_grid.Rebuild(packed_entities, positions, 16.f, 16.f);
+
+      auto start = std::chrono::steady_clock::now();
+      for (const auto& bullet : scene.bullets) {
+        const auto& pos = positions[bullet.id];
+        packed_grid.ForEachNearbyEntityOfType(
+            entity::Type::kEnemy, pos.x, pos.y, pos.x + 16.f, pos.y + 16.f,
+            [&](const entity::Entity& enemy) {
+              const auto& other = positions[enemy.id];
+              if (other.x < pos.x + 16.f && pos.x < other.x + 16.f &&
+                  other.y < pos.y + 16.f && pos.y < other.y + 16.f) {
+                per_bullet_hits++;
+              }
+            });
+      }
+      per_bullet += std::chrono::steady_clock::now() - start;
+
+      start = std::chrono::steady_clock::now();
+      batched_hits += (int)batched_narrowphase
+                          .FindHits(packed_grid, entity::Type::kBullet,
+                                    entity::Type::kEnemy, 16.f, 16.f)
+                          .size();
+      batched += std::chrono::steady_clock::now() - start;
+    }
+    printf("%8d %14.3f %14.3f %7d/%6d\n", enemy_count,
+           per_bullet.count() / kFrameCount, batched.count() / kFrameCount,
+           per_bullet_hits / kFrameCount, batched_hits / kFrameCount);
+  }
+}
+
+// enemies spread over an arena five times the view in each direction, the
+// screen grid clamps everything outside the view into its border cells
+void RunArenaWorkload() {
+  static collision::SpatialGrid spatial_grid;
+  static collision::WorldSpatialHash world_spatial_hash;
+
+  printf("arena enemies, queries along the view border\n");
+  printf("%8s %14s %14s %14s %14s\n", "enemies", "grid ms", "grid cands",
+         "world ms", "world cands");
+  for (int enemy_count : {500, 1000, 2000, constants::kEnemyShipCount}) {
+    spatial_grid.Clear();
+    world_spatial_hash.Clear();
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> x_dist(-2.f * constants::kGameWidth,
+                                                 3.f * constants::kGameWidth);
+    std::uniform_real_distribution<float> y_dist(-2.f * constants::kGameHeight,
+                                                 3.f * constants::kGameHeight);
+    std::uniform_real_distribution<float> border_dist(0.f, 1.f);
+    for (int id = 1; id <= enemy_count; id++) {
+      const entity::Entity enemy = {id, entity::Type::kEnemy};
+      positions[id] = {x_dist(rng), y_dist(rng)};
+      spatial_grid.Update(enemy, positions[id].x, positions[id].y, 16.f, 16.f);
+      world_spatial_hash.Update(enemy, positions[id].x, positions[id].y, 16.f,
+                                16.f);
+    }
+    std::vector<Position> queries;
+    for (int i = 0; i < kFrameCount * kBulletCount / 10; i++) {
+      const float t = border_dist(rng);
+      queries.push_back(i % 2 == 0
+                            ? Position{t * constants::kGameWidth, 0.f}
+                            : Position{0.f, t * constants::kGameHeight});
+    }
+
+    const auto time_queries = [&](auto& broadphase, int& candidates) {
+      const auto start = std::chrono::steady_clock::now();
+      for (const auto& query : queries) {
+        broadphase.ForEachNearbyEntityOfType(
+            entity::Type::kEnemy, query.x, query.y, query.x + 16.f,
+            query.y + 16.f, [&](const entity::Entity&) { candidates++; });
+      }
+      return std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - start)
+          .count();
+    };
+    int grid_candidates = 0;
+    int world_candidates = 0;
+    const double grid_ms = time_queries(spatial_grid, grid_candidates);
+    const double world_ms = time_queries(world_spatial_hash, world_candidates);
+    printf("%8d %14.3f %14d %14.3f %14d\n", enemy_count, grid_ms,
+           grid_candidates, world_ms, world_candidates);
+  }
+}
+
+// lasers from the left border to random points on the right border, once for
+// the first enemy hit and once for every enemy hit
+void RunSegmentWorkload() {
+  static collision::SpatialGrid spatial_grid;
+  std::vector<collision::SegmentHit> hits;
+
+  printf("spread enemies, screen wide lasers\n");
+  printf("%8s %14s %14s %14s %14s\n", "enemies", "scan ms", "first hit ms",
+         "all hits ms", "hits");
+  for (int enemy_count : {500, 1000, 2000, constants::kEnemyShipCount}) {
+    spatial_grid.Clear();
+    const Scene scene = CreateScene(enemy_count, false);
+    for (const auto& enemy : scene.enemies) {
+      spatial_grid.Update(enemy, positions[enemy.id].x, positions[enemy.id].y,
+                          16.f, 16.f);
+    }
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> y_dist(0.f, constants::kGameHeight);
+    std::vector<Position> lasers;
+    for (int i = 0; i < kFrameCount * 10; i++) {
+      lasers.push_back({y_dist(rng), y_dist(rng)});
+    }
+    const float width = constants::kGameWidth;
+
+    int scan_hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& laser : lasers) {
+      for (const auto& enemy : scene.enemies) {
+        const auto& pos = positions[enemy.id];
+        scan_hits +=
+            collision::SweptEntryTime(0.f, laser.x, width, laser.y - laser.x,
+                                      0.f, 0.f, pos.x, pos.y, 16.f,
+                                      16.f) >= 0.f;
+      }
+    }
+    const double scan_ms = std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+
+    const auto time_casts = [&](int max_hits, int& hit_count) {
+      const auto start = std::chrono::steady_clock::now();
+      for (const auto& laser : lasers) {
+        spatial_grid.CastSegmentOfType(entity::Type::kEnemy, 0.f, laser.x,
+                                       width, laser.y, positions, 16.f, 16.f,
+                                       max_hits, hits);
+        hit_count += (int)hits.size();
+      }
+      return std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - start)
+          .count();
+    };
+    int first_hits = 0;
+    int all_hits = 0;
+    const double first_hit_ms = time_casts(1, first_hits);
+    const double all_hits_ms = time_casts(enemy_count, all_hits);
+    printf("%8d %14.3f %14.3f %14.3f %7d/%6d\n", enemy_count, scan_ms,
+           first_hit_ms, all_hits_ms, scan_hits, all_hits);
+    if (first_hits == -1) {
+      printf("%d\n", first_hits);
+    }
+  }
+}
+
+// every bullet looks for its nearest enemy like a homing missile would, and
+// for the enemies in a blast radius around it
+void RunNearestWorkload() {
+  static collision::SpatialGrid spatial_grid;
+  std::vector<collision::NearbyEntity> nearby;
+  constexpr float kBlastRadius = 48.f;
+
+  printf("spread enemies, nearest enemy and blast radius per bullet\n");
+  printf("%8s %14s %14s %14s %14s\n", "enemies", "scan ms", "nearest ms",
+         "radius ms", "in radius");
+  for (int enemy_count : {500, 1000, 2000, constants::kEnemyShipCount}) {
+    spatial_grid.Clear();
+    const Scene scene = CreateScene(enemy_count, false);
+    std::chrono::duration<double, std::milli> scan{};
+    std::chrono::duration<double, std::milli> nearest{};
+    std::chrono::duration<double, std::milli> radius{};
+    float scan_sum = 0.f;
+    float nearest_sum = 0.f;
+    int in_radius = 0;
+    for (int frame = 0; frame < kFrameCount / 10; frame++) {
+      Step(scene);
+      for (const auto& enemy : scene.enemies) {
+        spatial_grid.Update(enemy, positions[enemy.id].x,
+                            positions[enemy.id].y, 16.f, 16.f);
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      for (const auto& bullet : scene.bullets) {
+        const auto& pos = positions[bullet.id];
+        float best = std::numeric_limits<float>::infinity();
+        for (const auto& enemy : scene.enemies) {
+          best = std::min(best, collision::BoxDistanceSq(
+                                    pos.x, pos.y, positions[enemy.id].x,
+                                    positions[enemy.id].y, 16.f, 16.f));
+        }
+        scan_sum += best;
+      }
+      scan += std::chrono::steady_clock::now() - start;
+
+      start = std::chrono::steady_clock::now();
+      for (const auto& bullet : scene.bullets) {
+        const auto& pos = positions[bullet.id];
+        collision::NearbyEntity found;
+        if (spatial_grid.FindNearestEntity(
+                collision::LayerBit(entity::Type::kEnemy), pos.x, pos.y,
+                positions, 16.f, 16.f, found)) {
+          nearest_sum += found.distance_sq;
+        }
+      }
+      nearest += std::chrono::steady_clock::now() - start;
+
+      start = std::chrono::steady_clock::now();
+      for (const auto& bullet : scene.bullets) {
+        const auto& pos = positions[bullet.id];
+        spatial_grid.FindEntitiesInRadius(
+            collision::LayerBit(entity::Type::kEnemy), pos.x, pos.y,
+            kBlastRadius, positions, 16.f, 16.f, nearby);
+        in_radius += (int)nearby.size();
+      }
+      radius += std::chrono::steady_clock::now() - start;
+    }
+    const int frames = kFrameCount / 10;
+    printf("%8d %14.3f %14.3f %14.3f %14d\n", enemy_count,
+           scan.count() / frames, nearest.count() / frames,
+           radius.count() / frames, in_radius / frames);
+    if (scan_sum != nearest_sum) {
+      printf("nearest distances differ from the scan\n");
+    }
+  }
+}
+
+// rebuild plus swept hit search like the rebuild mode of main.cpp, with as
+// many bullets as enemies, single threaded and on a WorkerPool
+void RunParallelWorkload() {
+  static collision::PackedGrid packed_grid;
+  static collision::BatchedNarrowphase batched_narrowphase;
+  static collision::BatchedNarrowphase threaded_narrowphase;
+  static Position previous_positions[constants::kEntityCount]{};
+  WorkerPool pool;
+  std::vector<entity::Entity> packed_entities;
+  std::vector<collision::HitPair> expected;
+
+  printf("spread enemies and as many bullets, rebuild and hits on %d threads\n",
+         pool.GetThreadCount());
+  printf("%8s %14s %14s %14s %14s\n", "enemies", "1 thread ms",
+         "threaded ms", "speedup", "identical");
+  for (int enemy_count : {500, 1000, 2000, constants::kEnemyShipCount}) {
+    const Scene scene = CreateScene(enemy_count, false, enemy_count);
+    packed_entities = scene.enemies;
+    packed_entities.insert(packed_entities.end(), scene.bullets.begin(),
+                           scene.bullets.end());
+    std::chrono::duration<double, std::milli> single{};
+    std::chrono::duration<double, std::milli> threaded{};
+    bool identical = true;
+    for (int frame = 0; frame < kFrameCount; frame++) {
+      std::copy(std::begin(positions), std::end(positions),
+                std::begin(previous_positions));
+      Step(scene);
+
+      auto start = std::chrono::steady_clock::now();
+      packed_grid.Rebuild(packed_entities, positions, previous_positions,
+                          16.f, 16.f);
+      expected = batched_narrowphase.FindHits(
+          packed_grid, entity::Type::kBullet, entity::Type::kEnemy, 16.f,
+          16.f, previous_positions);
+      single += std::chrono::steady_clock::now() - start;
+
+      start = std::chrono::steady_clock::now();
+      packed_grid.Rebuild(packed_entities, positions, previous_positions,
+                          16.f, 16.f, pool);
+      const auto& hits = threaded_narrowphase.FindHits(
+          packed_grid, entity::Type::kBullet, entity::Type::kEnemy, 16.f,
+          16.f, previous_positions, pool);
+      threaded += std::chrono::steady_clock::now() - start;
+
+      identical = identical && hits.size() == expected.size() &&
+                  std::equal(hits.begin(), hits.end(), expected.begin(),
+                             [](const collision::HitPair& a,
+                                const collision::HitPair& b) {
+                               return a.a == b.a && a.b == b.b;
+                             });
+    }
+    printf("%8d %14.3f %14.3f %13.2fx %14s\n", enemy_count,
+           single.count() / kFrameCount, threaded.count() / kFrameCount,
+           single.count() / threaded.count(), identical ? "yes" : "no");
+  }
+}
+
+// incremental grid at fixed resolutions and with the GridTuner starting from
+// the default one, with the grid stats of the last frame. runs long enough
+// for the tuner to look at the stats a few dozen times
+void RunTunerWorkload(bool clumped) {
+  static collision::SpatialGrid spatial_grid;
+  constexpr int kEnemyCount = constants::kEnemyShipCount;
+  constexpr int kTunerFrameCount = kFrameCount * 10;
+
+  printf("%d %s enemies, grid resolution\n", kEnemyCount,
+         clumped ? "clumped" : "spread");
+  printf("%12s %10s %10s %10s %10s %10s\n", "grid", "ms", "per cell",
+         "max cell", "cands", "hits %");
+  const auto run = [&](collision::GridDimensions dimensions, bool tune) {
+    collision::GridTuner tuner;
+    collision::GridStats stats;
+    spatial_grid.Clear();
+    spatial_grid.Resize(dimensions);
+    // the resolutions the tuner stepped through, a step back is an undo
+    std::string path;
+    int checksum = 0;
+    const double ms = Run(
+        kEnemyCount, clumped,
+        [&](const Scene& scene) {
+          for (const auto& enemy : scene.enemies) {
+            spatial_grid.Update(enemy, positions[enemy.id].x,
+                                positions[enemy.id].y, 16.f, 16.f);
+          }
+          int hits = 0;
+          for (const auto& bullet : scene.bullets) {
+            const auto& pos = positions[bullet.id];
+            spatial_grid.ForEachNearbyEntityOfType(
+                entity::Type::kEnemy, pos.x, pos.y, pos.x + 16.f,
+                pos.y + 16.f, [&](const entity::Entity& enemy) {
+                  const auto& other = positions[enemy.id];
+                  hits += other.x < pos.x + 16.f && pos.x < other.x + 16.f &&
+                          other.y < pos.y + 16.f && pos.y < other.y + 16.f;
+                });
+          }
+          spatial_grid.RecordHits(hits);
+          stats = spatial_grid.GetStats();
+          if (tune) {
+            if (tuner.Update(spatial_grid)) {
+              path += " -> " +
+                      std::to_string(spatial_grid.GetDimensions().cols) +
+                      "x" +
+                      std::to_string(spatial_grid.GetDimensions().rows);
+            }
+          } else {
+            spatial_grid.ResetStats();
+          }
+          return hits;
+        },
+        checksum, kTunerFrameCount);
+    const auto& tuned = spatial_grid.GetDimensions();
+    char name[32];
+    snprintf(name, sizeof(name), "%s%dx%d", tune ? "tuned " : "",
+             tuned.cols, tuned.rows);
+    printf("%12s %10.3f %10.1f %10d %10.1f %10.1f\n", name, ms,
+           stats.mean_per_cell, stats.max_per_cell,
+           stats.candidates_per_query, stats.hit_fraction * 100.f);
+    if (tune) {
+      printf("%12s %dx%d%s\n", "steps", dimensions.cols, dimensions.rows,
+             path.c_str());
+    }
+  };
+  for (const auto dimensions : {collision::GridDimensions{10, 8},
+                                collision::GridDimensions{},
+                                collision::GridDimensions{40, 30}}) {
+    run(dimensions, false);
+  }
+  run({}, true);
+}
+
+// every enemy looks for the enemies touching it, with the positions in a
+// ComponentPool in spawn order and re-sorted in MortonOrder
+void RunMortonWorkload() {
+  static collision::SpatialGrid spatial_grid;
+  static entity::MortonOrder morton_order;
+  static entity::ComponentPool<Position> pool_positions;
+  constexpr int kSortInterval = 60;
+
+  printf("spread enemies, neighbours of every enemy, component order\n");
+  printf("%8s %14s %14s %14s\n", "enemies", "spawn ms", "morton ms",
+         "sort ms");
+  for (int enemy_count : {1000, 2000, constants::kEnemyShipCount}) {
+    double ms[2]{};
+    double sort_ms = 0.;
+    int checksums[2]{};
+    for (int sorted = 0; sorted < 2; sorted++) {
+      spatial_grid.Clear();
+      pool_positions.Clear();
+      const Scene scene = CreateScene(enemy_count, false);
+      // the enemies get their ids in spawn order, which is random in space
+      std::vector<entity::Entity> enemies = scene.enemies;
+      for (const auto& enemy : enemies) {
+        pool_positions.Add(enemy.id, positions[enemy.id]);
+      }
+      std::chrono::duration<double, std::milli> elapsed{};
+      std::chrono::duration<double, std::milli> sorting{};
+      for (int frame = 0; frame < kFrameCount; frame++) {
+        if (sorted && frame % kSortInterval == 0) {
+          const auto start = std::chrono::steady_clock::now();
+          pool_positions.Reorder(morton_order.Sort(enemies, pool_positions));
+          std::sort(enemies.begin(), enemies.end(),
+                    [](const entity::Entity& a, const entity::Entity& b) {
+                      return pool_positions.IndexOf(a.id) <
+                             pool_positions.IndexOf(b.id);
+                    });
+          sorting += std::chrono::steady_clock::now() - start;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        // same movement as Step, on the pool
+        for (const auto& enemy : enemies) {
+          Drift(pool_positions[enemy.id], velocities[enemy.id]);
+        }
+        for (const auto& enemy : enemies) {
+          spatial_grid.Update(enemy, pool_positions[enemy.id].x,
+                              pool_positions[enemy.id].y, 16.f, 16.f);
+        }
+        // ids never change, the checksum counts touching pairs
+        for (const auto& enemy : enemies) {
+          const auto& pos = pool_positions[enemy.id];
+          spatial_grid.ForEachNearbyEntityOfType(
+              entity::Type::kEnemy, pos.x, pos.y, pos.x + 16.f, pos.y + 16.f,
+              [&](const entity::Entity& other) {
+                const auto& other_pos = pool_positions[other.id];
+                checksums[sorted] += other_pos.x < pos.x + 16.f &&
+                                     pos.x < other_pos.x + 16.f &&
+                                     other_pos.y < pos.y + 16.f &&
+                                     pos.y < other_pos.y + 16.f;
+              });
+        }
+        elapsed += std::chrono::steady_clock::now() - start;
+      }
+      ms[sorted] = elapsed.count() / kFrameCount;
+      sort_ms = sorting.count() / kFrameCount;
+    }
+    printf("%8d %14.3f %14.3f %14.3f%s\n", enemy_count, ms[0], ms[1],
+           sort_ms, checksums[0] == checksums[1] ? "" : " (pairs differ!)");
+  }
+}
+
+// the runtime sized SpatialGrid against BasicSpatialGrid instantiations of a
+// fixed size, with flat and with hashed cells
+void RunGridTemplateWorkload() {
+  static collision::SpatialGrid runtime_grid;
+  static collision::BasicSpatialGrid<entity::Entity,
+                                     collision::FixedGridDimensions<20, 15>>
+      fixed_grid;
+  static collision::BasicSpatialGrid<entity::Entity,
+                                     collision::FixedGridDimensions<20, 15>,
+                                     collision::HashCellStorage>
+      hashed_grid;
+
+  printf("spread enemies, 20x15 grid instantiations\n");
+  printf("%8s %14s %14s %14s\n", "enemies", "runtime ms", "fixed ms",
+         "hashed ms");
+  for (int enemy_count : {1000, 2000, constants::kEnemyShipCount}) {
+    int checksums[3]{};
+    const auto run = [&](auto& grid, int& checksum) {
+      grid.Clear();
+      return Run(
+          enemy_count, false,
+          [&](const Scene& scene) {
+            for (const auto& enemy : scene.enemies) {
+              grid.Update(enemy, positions[enemy.id].x, positions[enemy.id].y,
+                          16.f, 16.f);
+            }
+            return QueryBullets(grid, scene);
+          },
+          checksum);
+    };
+    const double runtime_ms = run(runtime_grid, checksums[0]);
+    const double fixed_ms = run(fixed_grid, checksums[1]);
+    const double hashed_ms = run(hashed_grid, checksums[2]);
+    printf("%8d %14.3f %14.3f %14.3f%s\n", enemy_count, runtime_ms, fixed_ms,
+           hashed_ms,
+           checksums[0] == checksums[1] && checksums[0] == checksums[2]
+               ? ""
+               : " (candidates differ!)");
+  }
+}
+
+// per-bullet grid queries against the candidates kept by the PairCache, for
+// a growing number of bullets. both keep the grid up to date, as the game has
+// to for its other queries
+void RunPairCacheWorkload() {
+  static collision::SpatialGrid spatial_grid;
+  static collision::PairCache pair_cache{entity::Type::kBullet,
+                                         entity::Type::kEnemy};
+  constexpr int kEnemyCount = constants::kEnemyShipCount;
+
+  printf("%d spread enemies, per-bullet queries or cached candidates\n",
+         kEnemyCount);
+  printf("%8s %14s %14s %14s %14s\n", "bullets", "query ms", "cache ms",
+         "reused %", "requeried");
+  for (int bullet_count : {300, 1000, 3000, constants::kBulletCount}) {
+    int checksums[2]{};
+    pair_cache.Clear();
+    pair_cache.ResetStats();
+    const auto run = [&](auto&& frame, int& checksum) {
+      spatial_grid.Clear();
+      const Scene scene = CreateScene(kEnemyCount, false, bullet_count);
+      std::chrono::duration<double, std::milli> elapsed{};
+      for (int frame_index = 0; frame_index < kFrameCount; frame_index++) {
+        Step(scene);
+        const auto start = std::chrono::steady_clock::now();
+        checksum += frame(scene);
+        elapsed += std::chrono::steady_clock::now() - start;
+      }
+      return elapsed.count() / kFrameCount;
+    };
+    const double query_ms = run(
+        [&](const Scene& scene) {
+          for (const auto& enemy : scene.enemies) {
+            spatial_grid.Update(enemy, positions[enemy.id].x,
+                                positions[enemy.id].y, 16.f, 16.f);
+          }
+          return QueryBullets(spatial_grid, scene);
+        },
+        checksums[0]);
+    const double cache_ms = run(
+        [&](const Scene& scene) {
+          for (const auto& enemy : scene.enemies) {
+            spatial_grid.Update(enemy, positions[enemy.id].x,
+                                positions[enemy.id].y, 16.f, 16.f);
+            pair_cache.Update(enemy, positions[enemy.id].x,
+                              positions[enemy.id].y, 16.f, 16.f);
+          }
+          // same boxes as the queries of QueryBullets
+          int candidates = 0;
+          for (const auto& bullet : scene.bullets) {
+            const auto& pos = positions[bullet.id];
+            pair_cache.ForEachCandidate(
+                spatial_grid, bullet, pos.x, pos.y, pos.x + 16.f,
+                pos.y + 16.f, [&](const entity::Entity&) { candidates++; });
+          }
+          pair_cache.EndFrame();
+          return candidates;
+        },
+        checksums[1]);
+    const collision::PairCacheStats& stats = pair_cache.GetStats();
+    const int lists = stats.reused + stats.requeried;
+    printf("%8d %14.3f %14.3f %14.1f %14.1f%s\n", bullet_count, query_ms,
+           cache_ms, lists > 0 ? stats.reused * 100.f / lists : 0.f,
+           (float)stats.requeried / stats.frames,
+           checksums[0] == checksums[1] ? "" : " (candidates differ!)");
+  }
+}
+
+// formations of constants::kEnemyGroupSize enemies like InitializeEnemies
+// spawns, squeezed into the view, each drifting in one direction
+void RunGroupWorkload() {
+  static collision::SpatialGrid spatial_grid;
+  static collision::AabbTree aabb_tree;
+  static collision::GroupBvh group_bvh;
+  const auto group_of = [](const entity::Entity& enemy) {
+    return (enemy.id - 1) / constants::kEnemyGroupSize;
+  };
+
+  printf("enemies in formations of %d\n", constants::kEnemyGroupSize);
+  printf("%8s %14s %14s %14s %14s %14s\n", "enemies", "grid ms",
+         "grid cands", "aabb tree ms", "groups ms", "group cands");
+  for (int enemy_count : {500, 1000, 2000, constants::kEnemyShipCount}) {
+    spatial_grid.Clear();
+    aabb_tree.Clear();
+    group_bvh.Clear();
+    const Scene scene = CreateScene(enemy_count, false);
+    const int group_count =
+        (enemy_count + constants::kEnemyGroupSize - 1) /
+        constants::kEnemyGroupSize;
+    const int group_cols = (int)std::ceil(std::sqrt(group_count * 4.f / 3.f));
+    const int group_rows = (group_count + group_cols - 1) / group_cols;
+    const float group_width = (float)constants::kGameWidth / group_cols;
+    const float group_height = (float)constants::kGameHeight / group_rows;
+    for (const auto& enemy : scene.enemies) {
+      const int group = group_of(enemy);
+      const int member = (enemy.id - 1) % constants::kEnemyGroupSize;
+      positions[enemy.id] = {
+          (group % group_cols) * group_width + (member % 10) * 4.f,
+          (group / group_cols) * group_height + (member / 10) * 4.f};
+      velocities[enemy.id] =
+          velocities[group * constants::kEnemyGroupSize + 1];
+    }
+    const std::vector<Position> initial(positions,
+                                        positions + constants::kEntityCount);
+    const std::vector<Velocity> initial_velocities(
+        velocities, velocities + constants::kEntityCount);
+
+    int candidates[2]{};
+    int checksum = 0;
+    const auto run = [&](auto&& frame, int& frame_checksum) {
+      std::copy(initial.begin(), initial.end(), positions);
+      std::copy(initial_velocities.begin(), initial_velocities.end(),
+                velocities);
+      std::chrono::duration<double, std::milli> elapsed{};
+      for (int frame_index = 0; frame_index < kFrameCount; frame_index++) {
+        Step(scene);
+        const auto begin = std::chrono::steady_clock::now();
+        frame_checksum += frame(scene);
+        elapsed += std::chrono::steady_clock::now() - begin;
+      }
+      return elapsed.count() / kFrameCount;
+    };
+    const double grid_ms = run(
+        [&](const Scene& frame_scene) {
+          for (const auto& enemy : frame_scene.enemies) {
+            spatial_grid.Update(enemy, positions[enemy.id].x,
+                                positions[enemy.id].y, 16.f, 16.f);
+          }
+          return QueryBullets(spatial_grid, frame_scene);
+        },
+        candidates[0]);
+    const double aabb_tree_ms = run(
+        [&](const Scene& frame_scene) {
+          for (const auto& enemy : frame_scene.enemies) {
+            aabb_tree.Update(enemy, positions[enemy.id].x,
+                             positions[enemy.id].y, 16.f, 16.f);
+          }
+          return QueryBullets(aabb_tree, frame_scene);
+        },
+        checksum);
+    const double group_ms = run(
+        [&](const Scene& frame_scene) {
+          group_bvh.Refit(frame_scene.enemies, positions, 16.f, 16.f,
+                          group_of);
+          return QueryBullets(group_bvh, frame_scene);
+        },
+        candidates[1]);
+    printf("%8d %14.3f %14.1f %14.3f %14.3f %14.1f\n", enemy_count, grid_ms,
+           (float)candidates[0] / kFrameCount / kBulletCount, aabb_tree_ms,
+           group_ms, (float)candidates[1] / kFrameCount / kBulletCount);
+    if (checksum == -1) {
+      printf("%d\n", checksum);
+    }
+  }
+}
+
+// movement of entities with ids scattered over the whole id range, through
+// arrays indexed by id, through ComponentPools, through the chunks of an
+// ArchetypeStore and through its views, on one thread and on all cores
+void RunComponentPoolWorkload() {
+  static Position previous_positions[constants::kEntityCount];
+  static entity::ComponentPool<Position> pool_positions;
+  static entity::ComponentPool<Position> pool_previous_positions;
+  static entity::ComponentPool<Velocity> pool_velocities;
+  // three archetypes like the player, enemies and bullets of main.cpp
+  using Store = entity::ArchetypeStore<Position, PreviousPosition, Velocity,
+                                       PlayerTag, EnemyTag, BulletTag>;
+  static Store store;
+  constexpr int kRepeats = 20;
+
+  printf("movement after churn, ids scattered over the whole id range\n");
+  static WorkerPool pool;
+  printf("%8s %10s %10s %10s %10s %10s %10s\n", "entities", "by id ms",
+         "dense ms", "chunks ms", "range ms", "each ms", "threads ms");
+  std::mt19937 rng(99);
+  for (int entity_count : {1000, 5000, constants::kEntityCount}) {
+    std::vector<int> ids(constants::kEntityCount);
+    for (int i = 0; i < constants::kEntityCount; i++) {
+      ids[i] = i;
+    }
+    std::shuffle(ids.begin(), ids.end(), rng);
+    ids.resize(entity_count);
+    pool_positions.Clear();
+    pool_previous_positions.Clear();
+    pool_velocities.Clear();
+    store.Clear();
+    for (const int id : ids) {
+      positions[id] = {(float)(id % 640), (float)(id % 480)};
+      velocities[id] = {(float)(id % 7) - 3.f, (float)(id % 5) - 2.f};
+      pool_positions.Add(id, positions[id]);
+      pool_previous_positions.Add(id, positions[id]);
+      pool_velocities.Add(id, velocities[id]);
+      const PreviousPosition previous{positions[id].x, positions[id].y};
+      if (id % 8 == 0) {
+        store.Add(id, positions[id], previous, velocities[id], BulletTag{});
+      } else if (id == ids[0]) {
+        store.Add(id, positions[id], previous, velocities[id], PlayerTag{});
+      } else {
+        store.Add(id, positions[id], previous, velocities[id], EnemyTag{});
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < kFrameCount * kRepeats; frame++) {
+      for (const int id : ids) {
+        previous_positions[id] = positions[id];
+        positions[id].x += velocities[id].x * kDeltaTime;
+        positions[id].y += velocities[id].y * kDeltaTime;
+      }
+    }
+    const std::chrono::duration<double, std::milli> by_id =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < kFrameCount * kRepeats; frame++) {
+      const auto pos = pool_positions.GetDense();
+      const auto previous = pool_previous_positions.GetDense();
+      const auto vel = pool_velocities.GetDense();
+      for (size_t i = 0; i < pos.size(); i++) {
+        previous[i] = pos[i];
+        pos[i].x += vel[i].x * kDeltaTime;
+        pos[i].y += vel[i].y * kDeltaTime;
+      }
+    }
+    const std::chrono::duration<double, std::milli> dense =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < kFrameCount * kRepeats; frame++) {
+      store.ForEachChunk<Position, PreviousPosition, const Velocity>(
+          [](int count, const int*, Position* pos, PreviousPosition* previous,
+             const Velocity* vel) {
+            for (int i = 0; i < count; i++) {
+              previous[i] = {pos[i].x, pos[i].y};
+              pos[i].x += vel[i].x * kDeltaTime;
+              pos[i].y += vel[i].y * kDeltaTime;
+            }
+          });
+    }
+    const std::chrono::duration<double, std::milli> chunks =
+        std::chrono::steady_clock::now() - start;
+
+    bool same = true;
+    for (const int id : ids) {
+      same = same && positions[id].x == pool_positions[id].x &&
+             positions[id].y == pool_positions[id].y &&
+             positions[id].x == store.Get<Position>(id).x &&
+             positions[id].y == store.Get<Position>(id).y;
+    }
+
+    // the views move the store on, the arrays catch up afterwards
+    const auto move = [](Position& pos, PreviousPosition& previous,
+                         const Velocity& vel) {
+      previous = {pos.x, pos.y};
+      pos.x += vel.x * kDeltaTime;
+      pos.y += vel.y * kDeltaTime;
+    };
+    const auto view = store.View<Position, PreviousPosition, const Velocity>();
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < kFrameCount * kRepeats; frame++) {
+      for (auto [pos, previous, vel] : view) {
+        move(pos, previous, vel);
+      }
+    }
+    const std::chrono::duration<double, std::milli> range =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < kFrameCount * kRepeats; frame++) {
+      view.ForEach(move);
+    }
+    const std::chrono::duration<double, std::milli> each =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < kFrameCount * kRepeats; frame++) {
+      view.ParallelForEach(pool, move);
+    }
+    const std::chrono::duration<double, std::milli> threads =
+        std::chrono::steady_clock::now() - start;
+
+    for (int frame = 0; frame < kFrameCount * kRepeats * 3; frame++) {
+      for (const int id : ids) {
+        positions[id].x += velocities[id].x * kDeltaTime;
+        positions[id].y += velocities[id].y * kDeltaTime;
+      }
+    }
+    for (const int id : ids) {
+      same = same && positions[id].x == store.Get<Position>(id).x &&
+             positions[id].y == store.Get<Position>(id).y;
+    }
+    printf("%8d %10.4f %10.4f %10.4f %10.4f %10.4f %10.4f%s\n",
+           entity_count, by_id.count() / (kFrameCount * kRepeats),
+           dense.count() / (kFrameCount * kRepeats),
+           chunks.count() / (kFrameCount * kRepeats),
+           range.count() / (kFrameCount * kRepeats),
+           each.count() / (kFrameCount * kRepeats),
+           threads.count() / (kFrameCount * kRepeats),
+           same ? "" : " (positions differ!)");
+  }
+}
+
+// steering, movement, rotation, grid upkeep, bullet queries and counting
+// stray bullets over an ArchetypeStore, like the systems of main.cpp. each
+// frame runs one system after another and then through the SystemScheduler,
+// with the views looping on one thread and on a WorkerPool
+void RunSchedulerWorkload() {
+  using Store = entity::ArchetypeStore<Position, PreviousPosition, Velocity,
+                                       RenderData, EnemyTag, BulletTag>;
+  static Store store;
+  static collision::SpatialGrid spatial_grid;
+  static WorkerPool view_pool;
+  constexpr SystemScheduler::Mask kGrid = SystemScheduler::Mask{1}
+                                          << Store::kComponentCount;
+  constexpr SystemScheduler::Mask kHits = kGrid << 1;
+  constexpr SystemScheduler::Mask kStray = kGrid << 2;
+  constexpr float kCenterX = constants::kGameWidth / 2.f;
+  constexpr float kCenterY = constants::kGameHeight / 2.f;
+
+  const Scene scene = CreateScene(constants::kEnemyShipCount, false, 1000);
+  bool threaded_views = false;
+  int hits = 0;
+  int stray = 0;
+  const auto for_each = [&](const auto& view, auto&& visit) {
+    if (threaded_views) {
+      view.ParallelForEach(view_pool, visit);
+    } else {
+      view.ForEach(visit);
+    }
+  };
+  SystemScheduler scheduler;
+  scheduler.Add("steer", Store::MaskOf<Position>(), Store::MaskOf<Velocity>(),
+                [&] {
+                  for_each(store.View<const Position, Velocity>()
+                               .With<EnemyTag>(),
+                           [](const Position& pos, Velocity& velocity) {
+                             const float x = kCenterX - pos.x;
+                             const float y = kCenterY - pos.y;
+                             const float length =
+                                 std::max(1.f, std::sqrt(x * x + y * y));
+                             velocity = {x / length * 100.f,
+                                         y / length * 100.f};
+                           });
+                });
+  scheduler.Add("move", Store::MaskOf<Velocity>(),
+                Store::MaskOf<Position, PreviousPosition>(), [&] {
+                  store.View<Position, PreviousPosition, const Velocity>()
+                      .ForEach([](Position& pos, PreviousPosition& previous,
+                                  const Velocity& velocity) {
+                        previous = {pos.x, pos.y};
+                        pos.x += velocity.x * kDeltaTime;
+                        pos.y += velocity.y * kDeltaTime;
+                        // bullets come back in on the other side
+                        pos.x = std::fmod(pos.x + constants::kGameWidth,
+                                          (float)constants::kGameWidth);
+                        pos.y = std::fmod(pos.y + constants::kGameHeight,
+                                          (float)constants::kGameHeight);
+                      });
+                });
+  scheduler.Add("rotate", Store::MaskOf<Position, Velocity>(),
+                Store::MaskOf<RenderData>(), [&] {
+                  for_each(store.View<const Position, const Velocity,
+                                      RenderData>()
+                               .With<EnemyTag>(),
+                           [](const Position&, const Velocity& velocity,
+                              RenderData& render_data) {
+                             render_data.angle =
+                                 std::atan2(velocity.y, velocity.x);
+                           });
+                });
+  scheduler.Add("grid", Store::MaskOf<Position>(), kGrid, [&] {
+    store.View<const Position>().With<EnemyTag>().ForEach(
+        [&](int id, const Position& pos) {
+          spatial_grid.Update({id, entity::Type::kEnemy}, pos.x, pos.y, 16.f,
+                              16.f);
+        });
+  });
+  scheduler.Add("collide", Store::MaskOf<Position>() | kGrid, kHits, [&] {
+    store.View<const Position>().With<BulletTag>().ForEach(
+        [&](const Position& pos) {
+          spatial_grid.ForEachNearbyEntityOfType(
+              entity::Type::kEnemy, pos.x, pos.y, pos.x + 16.f, pos.y + 16.f,
+              [&](const entity::Entity&) { hits++; });
+        });
+  });
+  scheduler.Add("stray", Store::MaskOf<Position>(), kStray, [&] {
+    store.View<const Position>().With<BulletTag>().ForEach(
+        [&](const Position& pos) {
+          stray += pos.x < 16.f || pos.y < 16.f;
+        });
+  });
+  scheduler.Build();
+  WorkerPool system_pool(scheduler.GetThreadCount());
+
+  printf("frame of %d systems over %d enemies and 1000 bullets, %d of them "
+         "can run at once, on %d threads\n",
+         scheduler.GetSystemCount(), constants::kEnemyShipCount,
+         scheduler.GetWidth(), system_pool.GetThreadCount());
+  printf("%14s %14s %14s\n", "views", "serial ms", "scheduled ms");
+  for (const bool threaded : {false, true}) {
+    threaded_views = threaded;
+    double ms[2]{};
+    int checksums[2]{};
+    for (int scheduled = 0; scheduled < 2; scheduled++) {
+      store.Clear();
+      spatial_grid.Clear();
+      for (const auto& enemy : scene.enemies) {
+        const Position& pos = positions[enemy.id];
+        store.Add(enemy.id, pos, PreviousPosition{pos.x, pos.y},
+                  velocities[enemy.id], RenderData{}, EnemyTag{});
+      }
+      for (const auto& bullet : scene.bullets) {
+        const Position& pos = positions[bullet.id];
+        store.Add(bullet.id, pos, PreviousPosition{pos.x, pos.y},
+                  velocities[bullet.id], RenderData{}, BulletTag{});
+      }
+      hits = 0;
+      stray = 0;
+      const auto start = std::chrono::steady_clock::now();
+      for (int frame = 0; frame < kFrameCount; frame++) {
+        if (scheduled) {
+          scheduler.Run(system_pool);
+        } else {
+          scheduler.Run();
+        }
+      }
+      const std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      ms[scheduled] = elapsed.count() / kFrameCount;
+      checksums[scheduled] = hits + stray;
+    }
+    printf("%14s %14.3f %14.3f%s\n",
+           threaded ? "thread pool" : "one thread", ms[0], ms[1],
+           checksums[0] == checksums[1] ? "" : " (results differ!)");
+  }
+  scheduler.PrintTimeline();
+}
+}  // namespace
+
+int main() {
+  RunWorkload(false);
+  RunWorkload(true);
+  RunNarrowphaseWorkload();
+  RunArenaWorkload();
+  RunSegmentWorkload();
+  RunNearestWorkload();
+  RunParallelWorkload();
+  RunTunerWorkload(false);
+  RunTunerWorkload(true);
+  RunMortonWorkload();
+  RunGridTemplateWorkload();
+  RunPairCacheWorkload();
+  RunGroupWorkload();
+  RunComponentPoolWorkload();
+  RunSchedulerWorkload();
+  return 0;
+}
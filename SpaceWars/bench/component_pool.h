@@ -0,0 +1,89 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "constants.h"
+
+namespace entity {
+// sparse set of one component type. sparse maps an entity id to the place of
+// its component in the dense arrays, which stay packed because removing moves
+// the last component into the hole. systems over every component of the type
+// walk the dense arrays front to back, lookups by id cost one extra index.
+// pools the same entities are added to and removed from in the same order
+// keep their dense arrays lined up, index i is the same entity in all of them
+template <typename Component>
+class ComponentPool {
+  int sparse[constants::kEntityCount];
+  std::vector<int> dense_ids;
+  std::vector<Component> dense;
+  // scratch of Reorder
+  std::vector<Component> reordered;
+
+ public:
+  ComponentPool() { std::fill(std::begin(sparse), std::end(sparse), -1); }
+
+  // overwrites the component if the entity already has one
+  Component& Add(int id, const Component& component = {}) {
+    if (Contains(id)) {
+      return dense[sparse[id]] = component;
+    }
+    sparse[id] = (int)dense.size();
+    dense_ids.emplace_back(id);
+    dense.emplace_back(component);
+    return dense.back();
+  }
+
+  // swap and pop, returns false if the entity has no component
+  bool Remove(int id) {
+    if (!Contains(id)) {
+      return false;
+    }
+    const int index = sparse[id];
+    dense[index] = dense.back();
+    dense_ids[index] = dense_ids.back();
+    sparse[dense_ids[index]] = index;
+    dense.pop_back();
+    dense_ids.pop_back();
+    sparse[id] = -1;
+    return true;
+  }
+
+  bool Contains(int id) const { return sparse[id] >= 0; }
+  int IndexOf(int id) const { return sparse[id]; }
+
+  // lookups by id, so a pool can be passed wherever the collision code takes
+  // positions indexed by entity id
+  Component& operator[](int id) { return dense[sparse[id]]; }
+  const Component& operator[](int id) const { return dense[sparse[id]]; }
+
+  // lays the components out in the order of ids, which has to hold every
+  // entity of the pool exactly once
+  void Reorder(std::span<const int> ids) {
+    reordered.clear();
+    for (const int id : ids) {
+      reordered.emplace_back(dense[sparse[id]]);
+    }
+    dense.swap(reordered);
+    dense_ids.assign(ids.begin(), ids.end());
+    for (int i = 0; i < (int)dense_ids.size(); i++) {
+      sparse[dense_ids[i]] = i;
+    }
+  }
+
+  void Clear() {
+    for (const int id : dense_ids) {
+      sparse[id] = -1;
+    }
+    dense_ids.clear();
+    dense.clear();
+  }
+
+  std::span<Component> GetDense() { return dense; }
+  std::span<const Component> GetDense() const { return dense; }
+  // id of the entity owning each dense component
+  std::span<const int> GetIds() const { return dense_ids; }
+  size_t size() const { return dense.size(); }
+};
+}  // namespace entity
@@ -0,0 +1,164 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "constants.h"
+#include "entity.h"
+#include "spatial_hash_grid.h"
+
+namespace collision {
+// how much work the pair cache carried over between frames, summed over the
+// frames since the last ResetStats
+struct PairCacheStats {
+  int frames = 0;
+  // candidate lists used as they were found in an earlier frame
+  int reused = 0;
+  // candidate lists found again with a grid query, because the entity moved
+  // to other cells or an entity of the other type entered or left one of them
+  int requeried = 0;
+  // updates that found the cells of an entity unchanged and did nothing
+  int unchanged_updates = 0;
+  int changed_updates = 0;
+};
+
+// keeps the candidates a SpatialGrid query found for the entities of one
+// type, bullets in the game, from one frame to the next. entities of the
+// other type, the enemies held by the grid, are passed to Update like to the
+// grid, and only stamp the cells they leave or enter with the current frame.
+// a candidate list is kept as long as its entity stays in the same cells and
+// none of them was stamped since it was found, otherwise it is found again
+// with a query, so the candidates always match what the grid would report.
+// call the updates and removals of a frame before its ForEachCandidate calls,
+// and EndFrame after them. enemies moving every frame stamp nearly every
+// cell, so it is slower than the plain queries and only kept in the bench
+// until it beats them
+class PairCache {
+  GridDimensions dimensions{};
+  entity::Type query_type;
+  entity::Type grid_type;
+  // last frame an entity of grid_type entered or left each cell
+  std::vector<int> changed_frames;
+  // cell range of every inserted entity, indexed by entity id
+  CellRange entity_ranges[constants::kEntityCount]{};
+  bool is_inserted[constants::kEntityCount]{};
+  // candidates of every query_type entity and the frame they were found in,
+  // 0 when there are none
+  std::vector<entity::Entity> candidates[constants::kEntityCount];
+  int found_frames[constants::kEntityCount]{};
+  int frame = 1;
+  PairCacheStats stats{};
+
+  void StampCells(const CellRange& range) {
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        changed_frames[dimensions.CellIndex(col, row)] = frame;
+      }
+    }
+  }
+
+  bool IsStale(const CellRange& range, int found_frame) const {
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        if (changed_frames[dimensions.CellIndex(col, row)] > found_frame) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+ public:
+  // dimensions have to match the grid the candidates are queried from
+  PairCache(entity::Type query_type, entity::Type grid_type,
+            GridDimensions dimensions = {})
+      : dimensions(dimensions),
+        query_type(query_type),
+        grid_type(grid_type),
+        changed_frames(dimensions.GetCellCount(), 0) {}
+
+  // same box around x, y as SpatialGrid::Update. entities of types other
+  // than grid_type are ignored
+  void Update(const entity::Entity& entity, float x, float y, float w,
+              float h) {
+    if (entity.type != grid_type) {
+      return;
+    }
+    const int id = entity.id;
+    const CellRange range =
+        dimensions.GetCellRange(x - w, y - h, x + w, y + h);
+    if (is_inserted[id] && entity_ranges[id] == range) {
+      stats.unchanged_updates++;
+      return;
+    }
+    stats.changed_updates++;
+    if (is_inserted[id]) {
+      StampCells(entity_ranges[id]);
+    }
+    StampCells(range);
+    entity_ranges[id] = range;
+    is_inserted[id] = true;
+  }
+
+  // stamps the cells of a grid_type entity, drops the candidates of a
+  // query_type one. does nothing if the entity is not in the cache
+  void Remove(const entity::Entity& entity) {
+    const int id = entity.id;
+    if (entity.type == query_type) {
+      candidates[id].clear();
+      found_frames[id] = 0;
+      return;
+    }
+    if (!is_inserted[id]) {
+      return;
+    }
+    StampCells(entity_ranges[id]);
+    is_inserted[id] = false;
+  }
+
+  void Clear() {
+    std::fill(changed_frames.begin(), changed_frames.end(), 0);
+    for (int id = 0; id < constants::kEntityCount; id++) {
+      candidates[id].clear();
+      found_frames[id] = 0;
+      is_inserted[id] = false;
+    }
+    frame = 1;
+  }
+
+  // calls visit(candidate) for every grid_type entity the grid would report
+  // for the box from x, y to x2, y2 of the query_type entity, from the
+  // candidates found in an earlier frame while they are still valid
+  template <typename Grid, typename Visitor>
+  void ForEachCandidate(Grid& grid, const entity::Entity& entity, float x,
+                        float y, float x2, float y2, Visitor&& visit) {
+    const int id = entity.id;
+    const CellRange range = dimensions.GetCellRange(x, y, x2, y2);
+    auto& found = candidates[id];
+    if (found_frames[id] == 0 || entity_ranges[id] != range ||
+        IsStale(range, found_frames[id])) {
+      found.clear();
+      grid.ForEachNearbyEntityOfType(
+          grid_type, x, y, x2, y2,
+          [&](const entity::Entity& other) { found.emplace_back(other); });
+      entity_ranges[id] = range;
+      found_frames[id] = frame;
+      stats.requeried++;
+    } else {
+      stats.reused++;
+    }
+    for (const auto& other : found) {
+      visit(other);
+    }
+  }
+
+  // call once a frame after the queries, later stamps are newer than every
+  // candidate list found so far
+  void EndFrame() {
+    stats.frames++;
+    frame++;
+  }
+
+  void ResetStats() { stats = {}; }
+  const PairCacheStats& GetStats() const { return stats; }
+};
+}  // namespace collision
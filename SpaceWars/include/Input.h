@@ -12,7 +12,9 @@ constexpr SDL_Scancode USED_SCANCODES[] = {
     SDL_SCANCODE_D,    SDL_SCANCODE_UP,     SDL_SCANCODE_DOWN,
     SDL_SCANCODE_LEFT, SDL_SCANCODE_RIGHT,  SDL_SCANCODE_SPACE,
     SDL_SCANCODE_X,    SDL_SCANCODE_ESCAPE, SDL_SCANCODE_RETURN,
-    SDL_SCANCODE_F1};
+    SDL_SCANCODE_F1,   SDL_SCANCODE_F2,     SDL_SCANCODE_F3,
+    SDL_SCANCODE_F4,   SDL_SCANCODE_F5,     SDL_SCANCODE_F7,
+    SDL_SCANCODE_F8};
 
 class Handler {
   static std::map<Axis, std::vector<SDL_Scancode>> axis_mappings;
@@ -0,0 +1,308 @@
+#pragma once
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "constants.h"
+#include "entity.h"
+#include "spatial_hash_grid.h"
+
+namespace collision {
+// how far a leaf box is grown on every side, entities can move this far before
+// their leaf has to be reinserted
+constexpr float aabb_tree_margin = 4.f;
+
+// incremental bounding volume hierarchy with one tree per collision layer.
+// leaves hold fattened entity boxes, inner nodes the union of their children,
+// and the tree is kept balanced with rotations so queries stay logarithmic no
+// matter how the entities are spread out or how much their sizes differ
+class AabbTree {
+  struct Box {
+    float min_x = 0;
+    float min_y = 0;
+    float max_x = 0;
+    float max_y = 0;
+
+    bool Contains(const Box& other) const {
+      return min_x <= other.min_x && min_y <= other.min_y &&
+             max_x >= other.max_x && max_y >= other.max_y;
+    }
+    bool Overlaps(float x, float y, float x2, float y2) const {
+      return min_x <= x2 && max_x >= x && min_y <= y2 && max_y >= y;
+    }
+    // cost metric used when picking where to insert a leaf
+    float Perimeter() const { return 2.f * (max_x - min_x + max_y - min_y); }
+    static Box Union(const Box& a, const Box& b) {
+      return {std::min(a.min_x, b.min_x), std::min(a.min_y, b.min_y),
+              std::max(a.max_x, b.max_x), std::max(a.max_y, b.max_y)};
+    }
+  };
+
+  struct Node {
+    Box box{};
+    // parent node, or the next free node while the node is unused
+    int parent = -1;
+    int child1 = -1;
+    int child2 = -1;
+    // 0 for leaves, -1 for free nodes
+    int height = -1;
+    entity::Entity entity{};
+
+    bool IsLeaf() const { return child1 == -1; }
+  };
+
+  std::vector<Node> nodes;
+  int free_list = -1;
+  int roots[layer_count];
+  // leaf node of every inserted entity, -1 when it is not inserted
+  int leaf_of[constants::kEntityCount];
+  // reused by queries so they do not allocate
+  std::vector<int> stack;
+
+  int AllocateNode() {
+    if (free_list == -1) {
+      nodes.emplace_back();
+      nodes.back().height = 0;
+      return (int)nodes.size() - 1;
+    }
+    const int index = free_list;
+    free_list = nodes[index].parent;
+    nodes[index] = Node{};
+    nodes[index].height = 0;
+    return index;
+  }
+
+  void FreeNode(int index) {
+    nodes[index].parent = free_list;
+    nodes[index].height = -1;
+    free_list = index;
+  }
+
+  // recomputes box and height of a node from its children
+  void Refit(int index) {
+    Node& node = nodes[index];
+    const Node& child1 = nodes[node.child1];
+    const Node& child2 = nodes[node.child2];
+    node.box = Box::Union(child1.box, child2.box);
+    node.height = 1 + std::max(child1.height, child2.height);
+  }
+
+  void ReplaceChild(int parent, int old_child, int new_child, int& root) {
+    if (parent == -1) {
+      root = new_child;
+    } else if (nodes[parent].child1 == old_child) {
+      nodes[parent].child1 = new_child;
+    } else {
+      nodes[parent].child2 = new_child;
+    }
+  }
+
+  // rotates the taller grandchild of a up if a is unbalanced, returns the
+  // node now sitting where a was
+  int Balance(int a, int& root) {
+    if (nodes[a].IsLeaf() || nodes[a].height < 2) {
+      return a;
+    }
+    const int b = nodes[a].child1;
+    const int c = nodes[a].child2;
+    const int balance = nodes[c].height - nodes[b].height;
+
+    if (balance > 1) {
+      // rotate c up
+      const int f = nodes[c].child1;
+      const int g = nodes[c].child2;
+      nodes[c].child1 = a;
+      nodes[c].parent = nodes[a].parent;
+      nodes[a].parent = c;
+      ReplaceChild(nodes[c].parent, a, c, root);
+      const bool f_taller = nodes[f].height > nodes[g].height;
+      const int kept = f_taller ? f : g;
+      const int moved = f_taller ? g : f;
+      nodes[c].child2 = kept;
+      nodes[a].child2 = moved;
+      nodes[moved].parent = a;
+      Refit(a);
+      Refit(c);
+      return c;
+    }
+    if (balance < -1) {
+      // rotate b up
+      const int d = nodes[b].child1;
+      const int e = nodes[b].child2;
+      nodes[b].child1 = a;
+      nodes[b].parent = nodes[a].parent;
+      nodes[a].parent = b;
+      ReplaceChild(nodes[b].parent, a, b, root);
+      const bool d_taller = nodes[d].height > nodes[e].height;
+      const int kept = d_taller ? d : e;
+      const int moved = d_taller ? e : d;
+      nodes[b].child2 = kept;
+      nodes[a].child1 = moved;
+      nodes[moved].parent = a;
+      Refit(a);
+      Refit(b);
+      return b;
+    }
+    return a;
+  }
+
+  // walks from index up to the root refitting and rebalancing every node
+  void FixUpwards(int index, int& root) {
+    while (index != -1) {
+      index = Balance(index, root);
+      Refit(index);
+      index = nodes[index].parent;
+    }
+  }
+
+  void InsertLeaf(int leaf, int& root) {
+    if (root == -1) {
+      root = leaf;
+      nodes[leaf].parent = -1;
+      return;
+    }
+
+    // descend towards the sibling that grows the total perimeter the least
+    const Box leaf_box = nodes[leaf].box;
+    int index = root;
+    while (!nodes[index].IsLeaf()) {
+      const Node& node = nodes[index];
+      const float perimeter = node.box.Perimeter();
+      const float combined = Box::Union(node.box, leaf_box).Perimeter();
+      // cost of making a new parent for this node and the leaf
+      const float cost = 2.f * combined;
+      // minimum cost of pushing the leaf further down
+      const float inheritance = 2.f * (combined - perimeter);
+      const auto child_cost = [&](int child) {
+        const Box& box = nodes[child].box;
+        const float grown = Box::Union(leaf_box, box).Perimeter();
+        if (nodes[child].IsLeaf()) {
+          return grown + inheritance;
+        }
+        return grown - box.Perimeter() + inheritance;
+      };
+      const float cost1 = child_cost(node.child1);
+      const float cost2 = child_cost(node.child2);
+      if (cost < cost1 && cost < cost2) {
+        break;
+      }
+      index = cost1 < cost2 ? node.child1 : node.child2;
+    }
+
+    const int sibling = index;
+    const int old_parent = nodes[sibling].parent;
+    const int new_parent = AllocateNode();
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].child1 = sibling;
+    nodes[new_parent].child2 = leaf;
+    ReplaceChild(old_parent, sibling, new_parent, root);
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+    FixUpwards(new_parent, root);
+  }
+
+  void RemoveLeaf(int leaf, int& root) {
+    if (leaf == root) {
+      root = -1;
+      return;
+    }
+    const int parent = nodes[leaf].parent;
+    const int grand_parent = nodes[parent].parent;
+    const int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2
+                                                     : nodes[parent].child1;
+    ReplaceChild(grand_parent, parent, sibling, root);
+    nodes[sibling].parent = grand_parent;
+    FreeNode(parent);
+    FixUpwards(grand_parent, root);
+  }
+
+ public:
+  AabbTree() { Clear(); }
+
+  // covers the same box around x, y as SpatialGrid::Update, grown by
+  // aabb_tree_margin. nothing happens while the entity stays inside that box
+  void Update(const entity::Entity& entity, float x, float y, float w,
+              float h) {
+    const Box box = {x - w, y - h, x + w, y + h};
+    int& root = roots[LayerOf(entity.type)];
+    int leaf = leaf_of[entity.id];
+    if (leaf != -1) {
+      if (nodes[leaf].box.Contains(box)) {
+        return;
+      }
+      RemoveLeaf(leaf, root);
+    } else {
+      leaf = AllocateNode();
+      nodes[leaf].entity = entity;
+      leaf_of[entity.id] = leaf;
+    }
+    nodes[leaf].box = {box.min_x - aabb_tree_margin,
+                       box.min_y - aabb_tree_margin,
+                       box.max_x + aabb_tree_margin,
+                       box.max_y + aabb_tree_margin};
+    InsertLeaf(leaf, root);
+  }
+
+  // does nothing if the entity is not inserted
+  void Remove(const entity::Entity& entity) {
+    const int leaf = leaf_of[entity.id];
+    if (leaf == -1) {
+      return;
+    }
+    RemoveLeaf(leaf, roots[LayerOf(entity.type)]);
+    FreeNode(leaf);
+    leaf_of[entity.id] = -1;
+  }
+
+  bool Contains(const entity::Entity& entity) const {
+    return leaf_of[entity.id] != -1;
+  }
+
+  void Clear() {
+    nodes.clear();
+    free_list = -1;
+    std::fill(std::begin(roots), std::end(roots), -1);
+    std::fill(std::begin(leaf_of), std::end(leaf_of), -1);
+  }
+
+  // height of the tree of a layer, -1 when the layer is empty
+  int GetHeight(entity::Type type) const {
+    const int root = roots[LayerOf(type)];
+    return root == -1 ? -1 : nodes[root].height;
+  }
+
+  // same contract as SpatialGrid::ForEachNearbyEntity, visits every entity
+  // whose fattened box overlaps the query box
+  template <typename Visitor>
+  void ForEachNearbyEntity(LayerMask layers, float x, float y, float x2,
+                           float y2, Visitor&& visit) {
+    for (int layer = 0; layer < layer_count; layer++) {
+      if ((layers & (1u << layer)) == 0 || roots[layer] == -1) {
+        continue;
+      }
+      stack.clear();
+      stack.emplace_back(roots[layer]);
+      while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        if (!node.box.Overlaps(x, y, x2, y2)) {
+          continue;
+        }
+        if (node.IsLeaf()) {
+          visit(node.entity);
+          continue;
+        }
+        stack.emplace_back(node.child1);
+        stack.emplace_back(node.child2);
+      }
+    }
+  }
+
+  template <typename Visitor>
+  void ForEachNearbyEntityOfType(entity::Type type, float x, float y,
+                                 float x2, float y2, Visitor&& visit) {
+    ForEachNearbyEntity(LayerBit(type), x, y, x2, y2,
+                        std::forward<Visitor>(visit));
+  }
+};
+}  // namespace collision
@@ -0,0 +1,546 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "constants.h"
+#include "worker_pool.h"
+
+namespace entity {
+constexpr size_t kChunkBytes = 16 * 1024;
+
+// keeps the components of every entity, entities with the same set of
+// component types share an archetype. an archetype stores its entities in
+// fixed size chunks, each one the ids of its rows followed by one column per
+// component (SoA), so a query over some components walks only the chunks of
+// the archetypes having all of them, a few linear arrays per chunk. chunks
+// are filled front to back and removing moves the last row of the archetype
+// into the hole. empty component types are tags, they pick the archetype but
+// take no memory. components are moved with memcpy and have to be trivially
+// copyable
+template <typename... Components>
+class ArchetypeStore {
+ public:
+  using Mask = uint32_t;
+  static constexpr int kComponentCount = sizeof...(Components);
+  static_assert(kComponentCount <= 32);
+  static_assert((std::is_trivially_copyable_v<Components> && ...));
+
+  template <typename Component>
+  static constexpr int IndexOf() {
+    constexpr bool matches[] = {
+        std::is_same_v<std::remove_const_t<Component>, Components>...};
+    for (int i = 0; i < kComponentCount; i++) {
+      if (matches[i]) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  template <typename... Cs>
+  static constexpr Mask MaskOf() {
+    static_assert(((IndexOf<Cs>() >= 0) && ...), "not a component");
+    return (Mask{0} | ... | (Mask{1} << IndexOf<Cs>()));
+  }
+
+  // where the components of an entity are, archetype is -1 for ids that are
+  // not in the store
+  struct Location {
+    int archetype = -1;
+    int chunk = 0;
+    int row = 0;
+  };
+
+  // stands in for an array of one component indexed by entity id, so the
+  // store can be passed wherever the collision code takes positions
+  template <typename Component>
+  class Lookup {
+    const ArchetypeStore* store;
+
+   public:
+    explicit Lookup(const ArchetypeStore* store) : store(store) {}
+    const Component& operator[](int id) const {
+      return store->template Get<Component>(id);
+    }
+  };
+
+ private:
+  static constexpr size_t kSizes[] = {
+      (std::is_empty_v<Components> ? 0 : sizeof(Components))...};
+  // columns start on this boundary, the chunk itself on a cache line
+  static constexpr size_t kColumnAlignment = 16;
+
+  struct Chunk {
+    alignas(64) std::byte bytes[kChunkBytes];
+  };
+
+  struct Archetype {
+    Mask mask = 0;
+    // rows per chunk
+    int capacity = 0;
+    // of the column of every component in the mask, the ids start at 0
+    size_t offsets[kComponentCount]{};
+    // every chunk but the last used one is full, chunks past size are kept
+    // for reuse
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    int size = 0;
+
+    int* GetIds(int chunk) {
+      return reinterpret_cast<int*>(chunks[chunk]->bytes);
+    }
+    const int* GetIds(int chunk) const {
+      return reinterpret_cast<const int*>(chunks[chunk]->bytes);
+    }
+    std::byte* GetColumn(int chunk, int component) {
+      return chunks[chunk]->bytes + offsets[component];
+    }
+    const std::byte* GetColumn(int chunk, int component) const {
+      return chunks[chunk]->bytes + offsets[component];
+    }
+    int GetUsedChunkCount() const { return (size + capacity - 1) / capacity; }
+    int GetRowCount(int chunk) const {
+      return std::min(capacity, size - chunk * capacity);
+    }
+  };
+
+  std::vector<Archetype> archetypes;
+  Location locations[constants::kEntityCount];
+  // scratch of Reorder
+  std::vector<int> archetype_ids;
+  std::vector<std::byte> reordered;
+
+  // returns the end of the last column
+  static size_t LayoutColumns(Mask mask, int capacity, size_t offsets[]) {
+    size_t offset = capacity * sizeof(int);
+    for (int i = 0; i < kComponentCount; i++) {
+      if (!(mask & (Mask{1} << i)) || kSizes[i] == 0) {
+        continue;
+      }
+      offset = (offset + kColumnAlignment - 1) / kColumnAlignment *
+               kColumnAlignment;
+      offsets[i] = offset;
+      offset += capacity * kSizes[i];
+    }
+    return offset;
+  }
+
+  int FindOrAddArchetype(Mask mask) {
+    for (int i = 0; i < (int)archetypes.size(); i++) {
+      if (archetypes[i].mask == mask) {
+        return i;
+      }
+    }
+    Archetype& archetype = archetypes.emplace_back();
+    archetype.mask = mask;
+    size_t row_bytes = sizeof(int);
+    for (int i = 0; i < kComponentCount; i++) {
+      if (mask & (Mask{1} << i)) {
+        row_bytes += kSizes[i];
+      }
+    }
+    // padding the columns to their alignment can push the last one out
+    archetype.capacity = (int)(kChunkBytes / row_bytes);
+    while (LayoutColumns(mask, archetype.capacity, archetype.offsets) >
+           kChunkBytes) {
+      archetype.capacity--;
+    }
+    return (int)archetypes.size() - 1;
+  }
+
+  template <typename Component>
+  static Component* GetColumn(Archetype& archetype, int chunk) {
+    return reinterpret_cast<Component*>(
+        archetype.GetColumn(chunk, IndexOf<Component>()));
+  }
+  template <typename Component>
+  static const Component* GetColumn(const Archetype& archetype, int chunk) {
+    return reinterpret_cast<const Component*>(
+        archetype.GetColumn(chunk, IndexOf<Component>()));
+  }
+
+  // copies every column of row from into row to, both of the same archetype
+  static void CopyRow(Archetype& archetype, int from_chunk, int from_row,
+                      int to_chunk, int to_row) {
+    archetype.GetIds(to_chunk)[to_row] = archetype.GetIds(from_chunk)[from_row];
+    for (int i = 0; i < kComponentCount; i++) {
+      if ((archetype.mask & (Mask{1} << i)) && kSizes[i] != 0) {
+        std::memcpy(archetype.GetColumn(to_chunk, i) + to_row * kSizes[i],
+                    archetype.GetColumn(from_chunk, i) + from_row * kSizes[i],
+                    kSizes[i]);
+      }
+    }
+  }
+
+ public:
+  // adds the entity with the given components, their types make up its
+  // archetype. does nothing if the id is already in the store
+  template <typename... Cs>
+  void Add(int id, const Cs&... components) {
+    if (Contains(id)) {
+      return;
+    }
+    const int archetype_index = FindOrAddArchetype(MaskOf<Cs...>());
+    Archetype& archetype = archetypes[archetype_index];
+    const int chunk = archetype.size / archetype.capacity;
+    const int row = archetype.size % archetype.capacity;
+    if (chunk == (int)archetype.chunks.size()) {
+      archetype.chunks.emplace_back(std::make_unique<Chunk>());
+    }
+    archetype.size++;
+    archetype.GetIds(chunk)[row] = id;
+    const auto store = [&](const auto& component) {
+      using Component = std::remove_cvref_t<decltype(component)>;
+      if constexpr (!std::is_empty_v<Component>) {
+        GetColumn<Component>(archetype, chunk)[row] = component;
+      }
+    };
+    (store(components), ...);
+    locations[id] = {archetype_index, chunk, row};
+  }
+
+  // moves the last row of the archetype into the hole, returns false if the
+  // id is not in the store
+  bool Remove(int id) {
+    if (!Contains(id)) {
+      return false;
+    }
+    const Location location = locations[id];
+    Archetype& archetype = archetypes[location.archetype];
+    const int last = archetype.size - 1;
+    const int last_chunk = last / archetype.capacity;
+    const int last_row = last % archetype.capacity;
+    if (location.chunk != last_chunk || location.row != last_row) {
+      CopyRow(archetype, last_chunk, last_row, location.chunk, location.row);
+      locations[archetype.GetIds(location.chunk)[location.row]] = location;
+    }
+    archetype.size--;
+    locations[id] = {};
+    return true;
+  }
+
+  bool Contains(int id) const { return locations[id].archetype >= 0; }
+
+  template <typename Component>
+  bool Has(int id) const {
+    return Contains(id) &&
+           (archetypes[locations[id].archetype].mask & MaskOf<Component>());
+  }
+
+  // the entity has to have the component
+  template <typename Component>
+  Component& Get(int id) {
+    const Location& location = locations[id];
+    return GetColumn<Component>(archetypes[location.archetype],
+                                location.chunk)[location.row];
+  }
+  template <typename Component>
+  const Component& Get(int id) const {
+    const Location& location = locations[id];
+    return GetColumn<Component>(archetypes[location.archetype],
+                                location.chunk)[location.row];
+  }
+
+  template <typename Component>
+  Lookup<Component> GetLookup() const {
+    return Lookup<Component>(this);
+  }
+
+  const Location& GetLocation(int id) const { return locations[id]; }
+
+  // calls visit(row_count, ids, columns...) for every chunk of the archetypes
+  // having all of Cs and every component in with but none in without.
+  // columns are pointers to the first row of each of Cs, const for const
+  // components
+  template <typename... Cs, typename Visitor>
+  void ForEachChunk(Mask with, Mask without, Visitor&& visit) {
+    static_assert((!std::is_empty_v<Cs> && ...), "tags go into with");
+    const Mask required = MaskOf<Cs...>() | with;
+    for (auto& archetype : archetypes) {
+      if ((archetype.mask & required) != required ||
+          (archetype.mask & without) != 0) {
+        continue;
+      }
+      for (int chunk = 0; chunk < archetype.GetUsedChunkCount(); chunk++) {
+        visit(archetype.GetRowCount(chunk),
+              (const int*)archetype.GetIds(chunk),
+              static_cast<Cs*>(
+                  GetColumn<std::remove_const_t<Cs>>(archetype, chunk))...);
+      }
+    }
+  }
+
+  template <typename... Cs, typename Visitor>
+  void ForEachChunk(Visitor&& visit) {
+    ForEachChunk<Cs...>(0, 0, std::forward<Visitor>(visit));
+  }
+
+  // the filter of a view nothing was filtered out of
+  struct AnyRow {
+    template <typename... Refs>
+    constexpr bool operator()(const Refs&...) const {
+      return true;
+    }
+  };
+
+  // rows of the archetypes having every one of Cs, every component in with
+  // and none in without, each row a std::tuple<Cs&...>, const references for
+  // const components. the filter is called with the same references and rows
+  // it returns false for are skipped. the storage of every component is found
+  // at compile time, the rows are read straight from the chunks
+  template <typename Filter, typename... Cs>
+  class Query {
+    static_assert((!std::is_empty_v<Cs> && ...), "tags go into With");
+
+    ArchetypeStore* store;
+    Mask with;
+    Mask without;
+    Filter filter;
+
+    bool Matches(const Archetype& archetype) const {
+      const Mask required = MaskOf<Cs...>() | with;
+      return (archetype.mask & required) == required &&
+             (archetype.mask & without) == 0;
+    }
+
+    static std::tuple<Cs*...> GetColumns(Archetype& archetype, int chunk) {
+      return {static_cast<Cs*>(
+          GetColumn<std::remove_const_t<Cs>>(archetype, chunk))...};
+    }
+
+    // visit is called as visit(id, Cs&...) if it takes the id, else as
+    // visit(Cs&...)
+    template <typename Visitor>
+    void VisitRows(Archetype& archetype, int chunk, Visitor& visit) const {
+      const int count = archetype.GetRowCount(chunk);
+      const int* ids = archetype.GetIds(chunk);
+      std::apply(
+          [&](Cs*... columns) {
+            for (int i = 0; i < count; i++) {
+              if (!filter(columns[i]...)) {
+                continue;
+              }
+              if constexpr (std::is_invocable_v<Visitor&, int, Cs&...>) {
+                visit(ids[i], columns[i]...);
+              } else {
+                visit(columns[i]...);
+              }
+            }
+          },
+          GetColumns(archetype, chunk));
+    }
+
+   public:
+    using Row = std::tuple<Cs&...>;
+
+    Query(ArchetypeStore* store, Mask with, Mask without, Filter filter)
+        : store(store), with(with), without(without), filter(filter) {}
+
+    // keeps the rows of archetypes having every one of Tags, which can be any
+    // component types, tags or not
+    template <typename... Tags>
+    Query With() const {
+      return {store, with | MaskOf<Tags...>(), without, filter};
+    }
+
+    template <typename... Tags>
+    Query Without() const {
+      return {store, with, without | MaskOf<Tags...>(), filter};
+    }
+
+    // keeps the rows keep(Cs&...) returns true for, on top of the current
+    // filter
+    template <typename Keep>
+    auto Where(Keep keep) const {
+      const auto both = [first = filter, keep](const Cs&... components) {
+        return first(components...) && keep(components...);
+      };
+      return Query<decltype(both), Cs...>(store, with, without, both);
+    }
+
+    class Sentinel {};
+
+    class Iterator {
+      const Query* query;
+      int archetype = 0;
+      // of the current archetype, the one after the chunk being walked
+      int next_chunk = 0;
+      int row = 0;
+      int count = 0;
+      const int* ids = nullptr;
+      std::tuple<Cs*...> columns;
+
+      // moves on to the first row from the current one on that the query
+      // yields, loading the next matching chunk once a chunk is done
+      void Settle() {
+        auto& archetypes = query->store->archetypes;
+        while (true) {
+          for (; row < count; row++) {
+            if (std::apply(
+                    [&](Cs*... c) { return query->filter(c[row]...); },
+                    columns)) {
+              return;
+            }
+          }
+          row = 0;
+          count = 0;
+          while (archetype < (int)archetypes.size() &&
+                 (!query->Matches(archetypes[archetype]) ||
+                  next_chunk >=
+                      archetypes[archetype].GetUsedChunkCount())) {
+            archetype++;
+            next_chunk = 0;
+          }
+          if (archetype == (int)archetypes.size()) {
+            return;
+          }
+          Archetype& current = archetypes[archetype];
+          count = current.GetRowCount(next_chunk);
+          ids = current.GetIds(next_chunk);
+          columns = GetColumns(current, next_chunk);
+          next_chunk++;
+        }
+      }
+
+     public:
+      explicit Iterator(const Query* query) : query(query) { Settle(); }
+
+      Row operator*() const {
+        return std::apply([&](Cs*... c) { return Row(c[row]...); }, columns);
+      }
+      Iterator& operator++() {
+        row++;
+        Settle();
+        return *this;
+      }
+      bool operator!=(Sentinel) const {
+        return archetype < (int)query->store->archetypes.size();
+      }
+      bool operator==(Sentinel sentinel) const {
+        return !(*this != sentinel);
+      }
+      // entity id of the current row
+      int GetId() const { return ids[row]; }
+    };
+
+    // the view has to outlive its iterators
+    Iterator begin() const { return Iterator(this); }
+    Sentinel end() const { return {}; }
+
+    // visit(Cs&...) or visit(id, Cs&...) for every row, a tight loop over
+    // the columns of each chunk
+    template <typename Visitor>
+    void ForEach(Visitor&& visit) const {
+      for (auto& archetype : store->archetypes) {
+        if (!Matches(archetype)) {
+          continue;
+        }
+        for (int chunk = 0; chunk < archetype.GetUsedChunkCount(); chunk++) {
+          VisitRows(archetype, chunk, visit);
+        }
+      }
+    }
+
+    // same, one task per chunk spread over the threads of the pool. visit
+    // runs on several threads at once and may only write to the components
+    // of its own row
+    template <typename Visitor>
+    void ParallelForEach(WorkerPool& pool, Visitor&& visit) const {
+      int chunk_count = 0;
+      for (const auto& archetype : store->archetypes) {
+        if (Matches(archetype)) {
+          chunk_count += archetype.GetUsedChunkCount();
+        }
+      }
+      pool.ParallelFor(chunk_count, [&](int index) {
+        for (auto& archetype : store->archetypes) {
+          if (!Matches(archetype)) {
+            continue;
+          }
+          if (index < archetype.GetUsedChunkCount()) {
+            VisitRows(archetype, index, visit);
+            return;
+          }
+          index -= archetype.GetUsedChunkCount();
+        }
+      });
+    }
+  };
+
+  // e.g. View<Position, const Velocity>().With<EnemyTag>()
+  template <typename... Cs>
+  Query<AnyRow, Cs...> View() {
+    return {this, 0, 0, AnyRow{}};
+  }
+
+  // lays the rows of every archetype out in the order of ids, which has to
+  // hold every entity of the store exactly once
+  void Reorder(std::span<const int> ids) {
+    for (int a = 0; a < (int)archetypes.size(); a++) {
+      Archetype& archetype = archetypes[a];
+      archetype_ids.clear();
+      for (const int id : ids) {
+        if (locations[id].archetype == a) {
+          archetype_ids.emplace_back(id);
+        }
+      }
+      // gather the rows in their new order column by column, then write
+      // them back to the chunks front to back
+      for (int i = -1; i < kComponentCount; i++) {
+        const bool is_ids = i < 0;
+        if (!is_ids && (!(archetype.mask & (Mask{1} << i)) || !kSizes[i])) {
+          continue;
+        }
+        const size_t size = is_ids ? sizeof(int) : kSizes[i];
+        reordered.resize(archetype_ids.size() * size);
+        for (size_t k = 0; k < archetype_ids.size(); k++) {
+          const Location& from = locations[archetype_ids[k]];
+          const std::byte* column =
+              is_ids ? (const std::byte*)archetype.GetIds(from.chunk)
+                     : archetype.GetColumn(from.chunk, i);
+          std::memcpy(&reordered[k * size], column + from.row * size, size);
+        }
+        for (size_t k = 0; k < archetype_ids.size(); k++) {
+          const int chunk = (int)k / archetype.capacity;
+          const int row = (int)k % archetype.capacity;
+          std::byte* column = is_ids
+                                  ? (std::byte*)archetype.GetIds(chunk)
+                                  : archetype.GetColumn(chunk, i);
+          std::memcpy(column + row * size, &reordered[k * size], size);
+        }
+      }
+      for (size_t k = 0; k < archetype_ids.size(); k++) {
+        locations[archetype_ids[k]] = {a, (int)k / archetype.capacity,
+                                       (int)k % archetype.capacity};
+      }
+    }
+  }
+
+  void Clear() {
+    for (auto& archetype : archetypes) {
+      for (int chunk = 0; chunk < archetype.GetUsedChunkCount(); chunk++) {
+        const int* ids = archetype.GetIds(chunk);
+        for (int row = 0; row < archetype.GetRowCount(chunk); row++) {
+          locations[ids[row]] = {};
+        }
+      }
+      archetype.size = 0;
+    }
+  }
+
+  int GetArchetypeCount() const { return (int)archetypes.size(); }
+  int GetChunkCount() const {
+    int count = 0;
+    for (const auto& archetype : archetypes) {
+      count += archetype.GetUsedChunkCount();
+    }
+    return count;
+  }
+};
+}  // namespace entity
@@ -12,8 +12,23 @@ struct Position {
 };
 
 struct RenderData {
-  Position* position = nullptr;
   SDL_Texture* texture = nullptr;
   float size[2] = {0, 0};
   double angle = 0;
-};
\ No newline at end of file
+};
+
+// position before the last movement step
+struct PreviousPosition {
+  float x = 0;
+  float y = 0;
+};
+
+// formation an enemy was spawned in
+struct Formation {
+  int group = 0;
+};
+
+// tags, they pick the archetype of an entity but take no memory
+struct PlayerTag {};
+struct EnemyTag {};
+struct BulletTag {};
@@ -8,5 +8,4 @@ constexpr int kEntityCount = 10001;
 constexpr int kEnemyGroupSize = 50;
 constexpr int kEnemyShipCount = 5000;
 constexpr int kBulletCount = 5000;
-constexpr int kLastEnemyIndex = kEntityCount - kEnemyShipCount;
 }  // namespace constants
@@ -1,6 +1,7 @@
 #pragma once
 namespace entity {
 enum class Type { kPlayer, kEnemy, kBullet };
+constexpr int kTypeCount = (int)Type::kBullet + 1;
 struct Entity {
   int id = 0;
   Type type = Type::kPlayer;
@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+
+#include "constants.h"
+#include "entity.h"
+
+namespace entity {
+// 32 bit reference to an entity that can be kept across frames. the low
+// kHandleIndexBits bits pick a record of the EntityAllocator, the rest are
+// the generation of that record, bumped every time an entity holding it is
+// destroyed. a handle kept past the death of its entity is stale and is
+// rejected instead of referring to whatever entity took the record over
+using Handle = uint32_t;
+constexpr int kHandleIndexBits = 20;
+constexpr uint32_t kHandleIndexMask = (1u << kHandleIndexBits) - 1;
+constexpr uint32_t kGenerationMask = (1u << (32 - kHandleIndexBits)) - 1;
+// generations start at 1, so no live entity ever has this handle
+constexpr Handle kInvalidHandle = 0;
+static_assert(constants::kEntityCount <= (1 << kHandleIndexBits));
+
+constexpr Handle MakeHandle(int index, uint32_t generation) {
+  return (generation << kHandleIndexBits) | (uint32_t)index;
+}
+constexpr int HandleIndex(Handle handle) {
+  return (int)(handle & kHandleIndexMask);
+}
+constexpr uint32_t HandleGeneration(Handle handle) {
+  return handle >> kHandleIndexBits;
+}
+
+// hands out entity ids to entities of any type, the id of an entity is the
+// index of its record. free records are kept in a fifo list threaded through
+// the records, so creating and destroying are O(1) and a record that was just
+// freed is the last one to be taken again, which keeps its generation from
+// wrapping around while old handles to it may still be around
+class EntityAllocator {
+  struct Record {
+    uint32_t generation = 1;
+    int next_free = -1;
+    Type type = Type::kPlayer;
+    bool is_alive = false;
+  };
+
+  Record records[constants::kEntityCount];
+  int free_head = 0;
+  int free_tail = constants::kEntityCount - 1;
+  int alive_count = 0;
+
+ public:
+  EntityAllocator() {
+    for (int i = 0; i < constants::kEntityCount; i++) {
+      records[i].next_free = i + 1 < constants::kEntityCount ? i + 1 : -1;
+    }
+  }
+
+  // takes the oldest free record, returns false when every id is in use
+  bool Create(Type type, Entity& entity) {
+    if (free_head < 0) {
+      return false;
+    }
+    const int index = free_head;
+    Record& record = records[index];
+    free_head = record.next_free;
+    if (free_head < 0) {
+      free_tail = -1;
+    }
+    record.next_free = -1;
+    record.type = type;
+    record.is_alive = true;
+    alive_count++;
+    entity = {index, type};
+    return true;
+  }
+
+  // frees the id of a live entity and makes every handle to it stale.
+  // returns false if the entity was already destroyed
+  bool Destroy(const Entity& entity) {
+    const int index = entity.id;
+    Record& record = records[index];
+    if (!record.is_alive || record.type != entity.type) {
+      return false;
+    }
+    record.is_alive = false;
+    // generation 0 is never handed out, see kInvalidHandle
+    record.generation = (record.generation + 1) & kGenerationMask;
+    if (record.generation == 0) {
+      record.generation = 1;
+    }
+    if (free_tail < 0) {
+      free_head = index;
+    } else {
+      records[free_tail].next_free = index;
+    }
+    free_tail = index;
+    alive_count--;
+    return true;
+  }
+
+  bool IsAlive(const Entity& entity) const {
+    const Record& record = records[entity.id];
+    return record.is_alive && record.type == entity.type;
+  }
+
+  Handle GetHandle(const Entity& entity) const {
+    return MakeHandle(entity.id, records[entity.id].generation);
+  }
+
+  // false for stale handles and handles that were never handed out
+  bool IsValid(Handle handle) const {
+    const int index = HandleIndex(handle);
+    return index < constants::kEntityCount && records[index].is_alive &&
+           records[index].generation == HandleGeneration(handle);
+  }
+
+  // the entity the handle refers to, false if the handle is stale
+  bool Resolve(Handle handle, Entity& entity) const {
+    if (!IsValid(handle)) {
+      return false;
+    }
+    const int index = HandleIndex(handle);
+    entity = {index, records[index].type};
+    return true;
+  }
+
+  int GetAliveCount() const { return alive_count; }
+};
+}  // namespace entity
@@ -0,0 +1,113 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "constants.h"
+#include "entity.h"
+
+namespace entity {
+// entities packed in a vector in no particular order, with the place of every
+// entity indexed by id. adding pushes to the back and removing moves the last
+// entity into the hole, so both are O(1) no matter how many entities the list
+// holds
+class EntityList {
+  std::vector<Entity> entities;
+  int index_of_id[constants::kEntityCount];
+
+ public:
+  EntityList() {
+    std::fill(std::begin(index_of_id), std::end(index_of_id), -1);
+  }
+
+  // returns false if the entity is already in the list
+  bool Add(const Entity& entity) {
+    if (Contains(entity)) {
+      return false;
+    }
+    index_of_id[entity.id] = (int)entities.size();
+    entities.emplace_back(entity);
+    return true;
+  }
+
+  // swap and pop, returns false if the entity is not in the list
+  bool Remove(const Entity& entity) {
+    if (!Contains(entity)) {
+      return false;
+    }
+    const int index = index_of_id[entity.id];
+    entities[index] = entities.back();
+    index_of_id[entities[index].id] = index;
+    entities.pop_back();
+    index_of_id[entity.id] = -1;
+    return true;
+  }
+
+  bool Contains(const Entity& entity) const {
+    const int index = index_of_id[entity.id];
+    return index >= 0 && entities[index] == entity;
+  }
+
+  void Clear() {
+    for (const auto& entity : entities) {
+      index_of_id[entity.id] = -1;
+    }
+    entities.clear();
+  }
+
+  // reorders the entities, adding and removing keep the order of the others
+  // apart from the one entity moved into a hole
+  template <typename Compare>
+  void Sort(Compare&& compare) {
+    std::sort(entities.begin(), entities.end(), compare);
+    for (int i = 0; i < (int)entities.size(); i++) {
+      index_of_id[entities[i].id] = i;
+    }
+  }
+
+  const std::vector<Entity>& GetEntities() const { return entities; }
+  size_t size() const { return entities.size(); }
+  bool empty() const { return entities.empty(); }
+  const Entity& operator[](size_t i) const { return entities[i]; }
+  auto begin() const { return entities.begin(); }
+  auto end() const { return entities.end(); }
+};
+
+// the active entities, all of them and again split by type. every list is
+// kept current on Add and Remove, so systems iterate the one they need as it
+// is instead of filtering a copy of all of them every frame
+class ActiveEntityLists {
+  EntityList all;
+  EntityList of_type[kTypeCount];
+
+ public:
+  bool Add(const Entity& entity) {
+    if (!all.Add(entity)) {
+      return false;
+    }
+    of_type[(int)entity.type].Add(entity);
+    return true;
+  }
+
+  bool Remove(const Entity& entity) {
+    if (!all.Remove(entity)) {
+      return false;
+    }
+    of_type[(int)entity.type].Remove(entity);
+    return true;
+  }
+
+  bool Contains(const Entity& entity) const { return all.Contains(entity); }
+
+  template <typename Compare>
+  void Sort(Compare&& compare) {
+    all.Sort(compare);
+    for (auto& list : of_type) {
+      list.Sort(compare);
+    }
+  }
+
+  const EntityList& GetAll() const { return all; }
+  const EntityList& GetOfType(Type type) const { return of_type[(int)type]; }
+};
+}  // namespace entity
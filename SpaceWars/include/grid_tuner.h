@@ -0,0 +1,152 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+
+#include "spatial_hash_grid.h"
+
+namespace collision {
+// limits the tuner keeps the grid inside and the stats that make it act
+struct GridTunerSettings {
+  // frames between two looks at the stats, the stats are reset after each
+  int frames_per_check = 60;
+  // crowded cells, or queries wading through many candidates that mostly
+  // miss, make the cells smaller
+  float max_mean_per_cell = 12.f;
+  float max_candidates_per_query = 8.f;
+  float min_hit_fraction = 0.05f;
+  // nearly empty cells make them larger, entities then span fewer cells
+  float min_mean_per_cell = 2.f;
+  // how much the cell count changes per axis in one step
+  float step = 1.25f;
+  // bounds of the tile size in pixels
+  float min_tile_size = 16.f;
+  float max_tile_size = 160.f;
+  // how far the mean per cell has to move from where a step was undone
+  // before steps that way are tried again
+  float retry_change = 0.25f;
+};
+
+// watches the stats of a SpatialGrid and re-buckets it with finer or coarser
+// cells when they drift past the thresholds, so the cell size follows the
+// number and clumping of the entities. a step that did not move the stat it
+// acted on the right way is undone at the next check, e.g. finer cells do
+// not thin out enemies clumped on one spot, and steps that way are held off
+// until the occupancy of the grid changes
+class GridTuner {
+  // which stat made the last step, compared at the next check
+  enum class Reason { kNone, kCrowded, kCandidates, kSparse };
+
+  GridTunerSettings settings{};
+  int frames = 0;
+  Reason last_reason = Reason::kNone;
+  GridStats stats_before_step{};
+  GridDimensions dimensions_before_step{};
+  // +1 finer, -1 coarser, the direction held off and the mean per cell it
+  // was undone at
+  int held_direction = 0;
+  float held_mean_per_cell = 0.f;
+
+  static float StatOf(Reason reason, const GridStats& stats) {
+    switch (reason) {
+      case Reason::kCrowded:
+      case Reason::kSparse:
+        return stats.mean_per_cell;
+      case Reason::kCandidates:
+        return stats.candidates_per_query;
+      default:
+        return 0.f;
+    }
+  }
+
+  // finer cells have to lower the stat, coarser ones have to raise it.
+  // crowded cells also have to get less full, finer cells around one clump
+  // add more edge cells and lower the mean without splitting the clump
+  static bool Helped(Reason reason, const GridStats& before,
+                     const GridStats& after) {
+    if (reason == Reason::kSparse) {
+      return StatOf(reason, after) > StatOf(reason, before);
+    }
+    return StatOf(reason, after) < StatOf(reason, before) &&
+           (reason != Reason::kCrowded ||
+            after.max_per_cell < before.max_per_cell);
+  }
+
+  // scales both axes, keeping the tile size inside the bounds
+  GridDimensions Scale(const GridDimensions& dimensions, float scale) const {
+    const auto scale_axis = [&](int count, int game_size) {
+      const int min_count =
+          std::max(1, (int)std::ceil(game_size / settings.max_tile_size));
+      const int max_count =
+          std::max(min_count, (int)(game_size / settings.min_tile_size));
+      int scaled = (int)std::lround(count * scale);
+      if (scaled == count) {
+        scaled += scale > 1.f ? 1 : -1;
+      }
+      return std::clamp(scaled, min_count, max_count);
+    };
+    return {scale_axis(dimensions.cols, constants::kGameWidth),
+            scale_axis(dimensions.rows, constants::kGameHeight)};
+  }
+
+ public:
+  GridTuner() = default;
+  explicit GridTuner(const GridTunerSettings& settings) : settings(settings) {}
+
+  // call once a frame after the queries and RecordHits, returns true when the
+  // grid was resized
+  bool Update(SpatialGrid& grid) {
+    if (++frames < settings.frames_per_check) {
+      return false;
+    }
+    frames = 0;
+    const GridStats stats = grid.GetStats();
+    grid.ResetStats();
+    if (stats.occupied_cells == 0) {
+      return false;
+    }
+
+    if (last_reason != Reason::kNone) {
+      const Reason reason = last_reason;
+      last_reason = Reason::kNone;
+      if (!Helped(reason, stats_before_step, stats)) {
+        held_direction = reason == Reason::kSparse ? -1 : 1;
+        held_mean_per_cell = stats_before_step.mean_per_cell;
+        grid.Resize(dimensions_before_step);
+        return true;
+      }
+    } else if (held_direction != 0 &&
+               std::abs(stats.mean_per_cell - held_mean_per_cell) >
+                   settings.retry_change * held_mean_per_cell) {
+      held_direction = 0;
+    }
+
+    Reason reason = Reason::kNone;
+    if (stats.mean_per_cell > settings.max_mean_per_cell) {
+      reason = Reason::kCrowded;
+    } else if (stats.candidates_per_query >
+                   settings.max_candidates_per_query &&
+               stats.hit_fraction < settings.min_hit_fraction) {
+      reason = Reason::kCandidates;
+    } else if (stats.mean_per_cell < settings.min_mean_per_cell) {
+      reason = Reason::kSparse;
+    }
+    const int direction = reason == Reason::kNone    ? 0
+                          : reason == Reason::kSparse ? -1
+                                                      : 1;
+    if (direction == 0 || direction == held_direction) {
+      return false;
+    }
+    const GridDimensions& dimensions = grid.GetDimensions();
+    const GridDimensions tuned = Scale(
+        dimensions, direction > 0 ? settings.step : 1.f / settings.step);
+    if (tuned == dimensions) {
+      return false;
+    }
+    last_reason = reason;
+    stats_before_step = stats;
+    dimensions_before_step = dimensions;
+    grid.Resize(tuned);
+    return true;
+  }
+};
+}  // namespace collision
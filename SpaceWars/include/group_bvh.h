@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <limits>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "components.h"
+#include "entity.h"
+#include "narrowphase.h"
+#include "spatial_hash_grid.h"
+
+namespace collision {
+// box around the members of one group, empty groups get an inverted box that
+// overlaps nothing
+struct GroupBounds {
+  float min_x = std::numeric_limits<float>::infinity();
+  float min_y = std::numeric_limits<float>::infinity();
+  float max_x = -std::numeric_limits<float>::infinity();
+  float max_y = -std::numeric_limits<float>::infinity();
+
+  // strict like SDL_HasIntersectionF
+  bool Overlaps(float x, float y, float x2, float y2) const {
+    return min_x < x2 && x < max_x && min_y < y2 && y < max_y;
+  }
+};
+
+// two level broadphase over the enemy formations InitializeEnemies lays out.
+// the first level is one box per group, refit from the positions of its
+// members every frame, the second level the members of each group packed
+// next to each other. queries only look at the members of groups whose box
+// they overlap, so while formations stay tight most of them are rejected with
+// a single test
+class GroupBvh {
+  std::vector<GroupBounds> group_bounds;
+  // members of group g are members[group_start[g]] up to
+  // members[group_start[g + 1]], the top left corners of their boxes are in
+  // member_x and member_y in the same order
+  std::vector<int> group_start;
+  std::vector<entity::Entity> members;
+  std::vector<float> member_x;
+  std::vector<float> member_y;
+  // group of every entity passed to Refit, in the same order, and the next
+  // free slot of every group while scattering them
+  std::vector<int> entity_groups;
+  std::vector<int> group_cursor;
+  std::vector<int> overlaps;
+  // size of the member boxes
+  float box_w = 0.f;
+  float box_h = 0.f;
+
+ public:
+  // regroups the entities and refits every group box. group_of(entity)
+  // returns the group of an entity, a small index starting at 0. every
+  // entity covers the same box around its position that SpatialGrid::Update
+  // inserts it with, positions are indexed by entity id
+  template <typename Positions, typename GroupOf>
+  void Refit(const std::vector<entity::Entity>& entities,
+             const Positions& positions, float w, float h,
+             GroupOf&& group_of) {
+    box_w = 2.f * w;
+    box_h = 2.f * h;
+    entity_groups.resize(entities.size());
+    int group_count = 0;
+    for (size_t i = 0; i < entities.size(); i++) {
+      entity_groups[i] = group_of(entities[i]);
+      group_count = std::max(group_count, entity_groups[i] + 1);
+    }
+
+    // counting sort by group, like PackedGrid::Rebuild
+    group_start.assign(group_count + 1, 0);
+    for (const int group : entity_groups) {
+      group_start[group + 1]++;
+    }
+    for (int group = 0; group < group_count; group++) {
+      group_start[group + 1] += group_start[group];
+    }
+    members.resize(entities.size());
+    member_x.resize(entities.size());
+    member_y.resize(entities.size());
+    group_bounds.assign(group_count, {});
+    group_cursor.assign(group_start.begin(), group_start.end() - 1);
+    for (size_t i = 0; i < entities.size(); i++) {
+      const int group = entity_groups[i];
+      const int slot = group_cursor[group]++;
+      const auto& pos = positions[entities[i].id];
+      members[slot] = entities[i];
+      member_x[slot] = pos.x - w;
+      member_y[slot] = pos.y - h;
+      GroupBounds& bounds = group_bounds[group];
+      bounds.min_x = std::min(bounds.min_x, pos.x - w);
+      bounds.min_y = std::min(bounds.min_y, pos.y - h);
+      bounds.max_x = std::max(bounds.max_x, pos.x + w);
+      bounds.max_y = std::max(bounds.max_y, pos.y + h);
+    }
+  }
+
+  void Clear() {
+    group_bounds.clear();
+    group_start.assign(1, 0);
+    members.clear();
+    member_x.clear();
+    member_y.clear();
+  }
+
+  int GetGroupCount() const { return (int)group_bounds.size(); }
+  const GroupBounds& GetGroupBounds(int group) const {
+    return group_bounds[group];
+  }
+  std::span<const entity::Entity> GetGroupMembers(int group) const {
+    return {members.data() + group_start[group],
+            members.data() + group_start[group + 1]};
+  }
+
+  // the coarse level on its own, calls visit(group) for every group whose box
+  // overlaps the box from x, y to x2, y2
+  template <typename Visitor>
+  void ForEachGroupOverlapping(float x, float y, float x2, float y2,
+                               Visitor&& visit) const {
+    for (int group = 0; group < (int)group_bounds.size(); group++) {
+      if (group_bounds[group].Overlaps(x, y, x2, y2)) {
+        visit(group);
+      }
+    }
+  }
+
+  // same contract as SpatialGrid::ForEachNearbyEntity, visits every entity
+  // whose box overlaps the query box. the members of an overlapped group are
+  // tested a simd register at a time
+  template <typename Visitor>
+  void ForEachNearbyEntity(LayerMask layers, float x, float y, float x2,
+                           float y2, Visitor&& visit) {
+    for (int group = 0; group < (int)group_bounds.size(); group++) {
+      if (!group_bounds[group].Overlaps(x, y, x2, y2)) {
+        continue;
+      }
+      const int start = group_start[group];
+      const int end = group_start[group + 1];
+      overlaps.clear();
+      FindOverlaps(x, y, x2, y2, box_w, box_h,
+                   {member_x.data() + start, member_x.data() + end},
+                   {member_y.data() + start, member_y.data() + end},
+                   overlaps);
+      for (const int i : overlaps) {
+        const auto& entity = members[start + i];
+        if (layers & LayerBit(entity.type)) {
+          visit(entity);
+        }
+      }
+    }
+  }
+
+  template <typename Visitor>
+  void ForEachNearbyEntityOfType(entity::Type type, float x, float y,
+                                 float x2, float y2, Visitor&& visit) {
+    ForEachNearbyEntity(LayerBit(type), x, y, x2, y2,
+                        std::forward<Visitor>(visit));
+  }
+};
+}  // namespace collision
@@ -0,0 +1,55 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "entity.h"
+#include "spatial_hash_grid.h"
+
+namespace entity {
+// interleaves the bits of col and row, cells close to each other on the grid
+// get close codes (z-order curve)
+inline uint32_t MortonCode(uint16_t col, uint16_t row) {
+  const auto spread = [](uint32_t bits) {
+    bits = (bits | (bits << 8)) & 0x00ff00ffu;
+    bits = (bits | (bits << 4)) & 0x0f0f0f0fu;
+    bits = (bits | (bits << 2)) & 0x33333333u;
+    bits = (bits | (bits << 1)) & 0x55555555u;
+    return bits;
+  };
+  return spread(col) | (spread(row) << 1);
+}
+
+// orders the active entities by the morton code of their grid cell, laying
+// the rows of the archetype store out in that order puts entities in nearby
+// cells next to each other in memory. ids do not change, so the broadphases
+// keep their contents
+class MortonOrder {
+  // scratch reused by every sort
+  std::vector<std::pair<uint32_t, int>> keys;
+  std::vector<int> order;
+
+ public:
+  // returns the ids of the active entities in morton order, ties keep their
+  // order in active. see ArchetypeStore::Reorder
+  template <typename Positions>
+  const std::vector<int>& Sort(std::span<const Entity> active,
+                               const Positions& positions) {
+    keys.clear();
+    for (int i = 0; i < (int)active.size(); i++) {
+      const auto& pos = positions[active[i].id];
+      const collision::CellRange cell =
+          collision::GetCellRange(pos.x, pos.y, pos.x, pos.y);
+      keys.emplace_back(MortonCode(cell.min_col, cell.min_row), i);
+    }
+    std::sort(keys.begin(), keys.end());
+    order.clear();
+    for (const auto& key : keys) {
+      order.emplace_back(active[key.second].id);
+    }
+    return order;
+  }
+};
+}  // namespace entity
@@ -0,0 +1,253 @@
+#pragma once
+#include <algorithm>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPACEWARS_NARROWPHASE_SSE2
+#endif
+
+#include "components.h"
+#include "entity.h"
+#include "packed_grid.h"
+#include "spatial_hash_grid.h"
+#include "worker_pool.h"
+
+namespace collision {
+struct HitPair {
+  entity::Entity a{};
+  entity::Entity b{};
+};
+
+// appends the index of every w by h box, given by its top left corner in xs and
+// ys, that overlaps the box from x, y to x2, y2. overlaps are strict like
+// SDL_HasIntersectionF, boxes that only touch do not count. boxes are tested
+// 8 (avx2) or 4 (sse2) at a time, the rest one by one
+inline void FindOverlaps(float x, float y, float x2, float y2, float w,
+                         float h, std::span<const float> xs,
+                         std::span<const float> ys, std::vector<int>& hits) {
+  // a box overlaps when its corner lies inside the query box grown by its size
+  // to the top left
+  const float min_x = x - w;
+  const float max_x = x2;
+  const float min_y = y - h;
+  const float max_y = y2;
+  const int count = (int)xs.size();
+  int i = 0;
+#if defined(__AVX2__)
+  const __m256 lane_min_x = _mm256_set1_ps(min_x);
+  const __m256 lane_max_x = _mm256_set1_ps(max_x);
+  const __m256 lane_min_y = _mm256_set1_ps(min_y);
+  const __m256 lane_max_y = _mm256_set1_ps(max_y);
+  for (; i + 8 <= count; i += 8) {
+    const __m256 other_x = _mm256_loadu_ps(&xs[i]);
+    const __m256 other_y = _mm256_loadu_ps(&ys[i]);
+    const __m256 overlap = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(lane_min_x, other_x, _CMP_LT_OQ),
+                      _mm256_cmp_ps(other_x, lane_max_x, _CMP_LT_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(lane_min_y, other_y, _CMP_LT_OQ),
+                      _mm256_cmp_ps(other_y, lane_max_y, _CMP_LT_OQ)));
+    const int mask = _mm256_movemask_ps(overlap);
+    for (int lane = 0; mask != 0 && lane < 8; lane++) {
+      if (mask & (1 << lane)) {
+        hits.emplace_back(i + lane);
+      }
+    }
+  }
+#elif defined(SPACEWARS_NARROWPHASE_SSE2)
+  const __m128 lane_min_x = _mm_set1_ps(min_x);
+  const __m128 lane_max_x = _mm_set1_ps(max_x);
+  const __m128 lane_min_y = _mm_set1_ps(min_y);
+  const __m128 lane_max_y = _mm_set1_ps(max_y);
+  for (; i + 4 <= count; i += 4) {
+    const __m128 other_x = _mm_loadu_ps(&xs[i]);
+    const __m128 other_y = _mm_loadu_ps(&ys[i]);
+    const __m128 overlap =
+        _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(lane_min_x, other_x),
+                              _mm_cmplt_ps(other_x, lane_max_x)),
+                   _mm_and_ps(_mm_cmplt_ps(lane_min_y, other_y),
+                              _mm_cmplt_ps(other_y, lane_max_y)));
+    const int mask = _mm_movemask_ps(overlap);
+    for (int lane = 0; mask != 0 && lane < 4; lane++) {
+      if (mask & (1 << lane)) {
+        hits.emplace_back(i + lane);
+      }
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    if (min_x < xs[i] && xs[i] < max_x && min_y < ys[i] && ys[i] < max_y) {
+      hits.emplace_back(i);
+    }
+  }
+}
+
+// same for a w by h box at x, y
+inline void FindOverlaps(float x, float y, float w, float h,
+                         std::span<const float> xs, std::span<const float> ys,
+                         std::vector<int>& hits) {
+  FindOverlaps(x, y, x + w, y + h, w, h, xs, ys, hits);
+}
+
+// narrowphase over the cells of a PackedGrid. every entity of one layer is
+// tested against the packed positions of the other layer in the same cell, a
+// whole simd register at a time. a pair is only reported by the cell holding
+// the top left corner of the overlap, so pairs sharing several cells are not
+// reported twice
+class BatchedNarrowphase {
+  // scratch and output of one task of a parallel search
+  struct TaskHits {
+    std::vector<int> overlaps;
+    std::vector<HitPair> hits;
+  };
+  // tasks per thread of a parallel search, cells are split into more tasks
+  // than threads so a thread that got crowded cells does not hold up the rest
+  static constexpr int kTasksPerThread = 4;
+
+  std::vector<int> overlaps;
+  std::vector<HitPair> hits;
+  std::vector<TaskHits> task_hits;
+
+  // the grid stores entities under boxes twice their size, only an entity
+  // reaching into the cell itself can have an overlap corner there. the bounds
+  // get a pixel of slack so rounding in GetCellRange can not drop a pair, and
+  // the border cells reach to infinity because GetCellRange clamps into them
+  static void GetCellBounds(int cell, float& min_x, float& min_y,
+                            float& max_x, float& max_y) {
+    constexpr float kInfinity = std::numeric_limits<float>::infinity();
+    const int col = cell % grid_cols;
+    const int row = cell / grid_cols;
+    min_x = col == 0 ? -kInfinity : col * grid_tile_width - 1.f;
+    min_y = row == 0 ? -kInfinity : row * grid_tile_height - 1.f;
+    max_x = col == grid_cols - 1 ? kInfinity
+                                 : (col + 1) * grid_tile_width + 1.f;
+    max_y = row == grid_rows - 1 ? kInfinity
+                                 : (row + 1) * grid_tile_height + 1.f;
+  }
+
+  // stands in for the previous positions when the boxes are not swept
+  struct Unswept {};
+
+  // appends the hits of the cells from cell_begin up to cell_end to out_hits
+  template <typename Positions>
+  static void FindHitsInCells(const PackedGrid& grid, int cell_begin,
+                              int cell_end, int a_layer, int b_layer, float w,
+                              float h, const Positions& a_previous_positions,
+                              std::vector<int>& overlaps,
+                              std::vector<HitPair>& out_hits) {
+    for (int cell = cell_begin; cell < cell_end; cell++) {
+      const auto a_entities = grid.GetCell(a_layer, cell);
+      const auto b_entities = grid.GetCell(b_layer, cell);
+      if (a_entities.empty() || b_entities.empty()) {
+        continue;
+      }
+      float cell_min_x, cell_min_y, cell_max_x, cell_max_y;
+      GetCellBounds(cell, cell_min_x, cell_min_y, cell_max_x, cell_max_y);
+      const auto a_x = grid.GetCellX(a_layer, cell);
+      const auto a_y = grid.GetCellY(a_layer, cell);
+      const auto b_x = grid.GetCellX(b_layer, cell);
+      const auto b_y = grid.GetCellY(b_layer, cell);
+
+      for (size_t a = 0; a < a_entities.size(); a++) {
+        const float x = a_x[a];
+        const float y = a_y[a];
+        float previous_x = x;
+        float previous_y = y;
+        if constexpr (!std::is_same_v<Positions, Unswept>) {
+          previous_x = a_previous_positions[a_entities[a].id].x;
+          previous_y = a_previous_positions[a_entities[a].id].y;
+        }
+        // box covering the whole move
+        const float min_x = std::min(x, previous_x);
+        const float min_y = std::min(y, previous_y);
+        const float max_x = std::max(x, previous_x) + w;
+        const float max_y = std::max(y, previous_y) + h;
+        if (min_x >= cell_max_x || max_x <= cell_min_x ||
+            min_y >= cell_max_y || max_y <= cell_min_y) {
+          continue;
+        }
+        overlaps.clear();
+        FindOverlaps(min_x, min_y, max_x, max_y, w, h, b_x, b_y, overlaps);
+        const bool moved = x != previous_x || y != previous_y;
+        for (const int b : overlaps) {
+          // the swept box also covers corners the box never passed through
+          if (moved && !SweptOverlaps(previous_x, previous_y, x - previous_x,
+                                      y - previous_y, w, h, b_x[b], b_y[b], w,
+                                      h)) {
+            continue;
+          }
+          const float corner_x = std::max(min_x, b_x[b]);
+          const float corner_y = std::max(min_y, b_y[b]);
+          const CellRange corner_cell =
+              GetCellRange(corner_x, corner_y, corner_x, corner_y);
+          if (CellIndex(corner_cell.min_col, corner_cell.min_row) != cell) {
+            continue;
+          }
+          out_hits.push_back({a_entities[a], b_entities[b]});
+        }
+      }
+    }
+  }
+
+ public:
+  // every entity is a w by h box extending from its position to the bottom
+  // right like the rendered sprites. returns pairs of a_type and b_type
+  // entities whose boxes overlap, the buffer is reused by the next call.
+  // with a_previous_positions, indexed by entity id, the a_type entities are
+  // swept from their previous position to the current one and hit everything
+  // they passed through. the grid has to be rebuilt with the same previous
+  // positions so the swept boxes are in every cell they cross
+  const std::vector<HitPair>& FindHits(const PackedGrid& grid,
+                                       entity::Type a_type,
+                                       entity::Type b_type, float w, float h) {
+    return FindHits(grid, a_type, b_type, w, h, Unswept{});
+  }
+
+  template <typename Positions>
+  const std::vector<HitPair>& FindHits(const PackedGrid& grid,
+                                       entity::Type a_type,
+                                       entity::Type b_type, float w, float h,
+                                       const Positions& a_previous_positions) {
+    hits.clear();
+    FindHitsInCells(grid, 0, grid_cell_count, LayerOf(a_type),
+                    LayerOf(b_type), w, h, a_previous_positions, overlaps,
+                    hits);
+    return hits;
+  }
+
+  // same on the threads of a pool. every task searches a contiguous range of
+  // cells into its own list and the lists are joined in cell order, so the
+  // pairs come out in the same order as with the single threaded search
+  template <typename Positions>
+  const std::vector<HitPair>& FindHits(const PackedGrid& grid,
+                                       entity::Type a_type,
+                                       entity::Type b_type, float w, float h,
+                                       const Positions& a_previous_positions,
+                                       WorkerPool& pool) {
+    const int task_count =
+        std::min(pool.GetThreadCount() * kTasksPerThread, grid_cell_count);
+    task_hits.resize(task_count);
+    pool.ParallelFor(task_count, [&](int task) {
+      TaskHits& task_output = task_hits[task];
+      task_output.hits.clear();
+      FindHitsInCells(grid, task * grid_cell_count / task_count,
+                      (task + 1) * grid_cell_count / task_count,
+                      LayerOf(a_type), LayerOf(b_type), w, h,
+                      a_previous_positions, task_output.overlaps,
+                      task_output.hits);
+    });
+    hits.clear();
+    for (const auto& task_output : task_hits) {
+      hits.insert(hits.end(), task_output.hits.begin(),
+                  task_output.hits.end());
+    }
+    return hits;
+  }
+};
+}  // namespace collision
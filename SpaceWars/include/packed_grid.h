@@ -0,0 +1,214 @@
+#pragma once
+#include <algorithm>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "components.h"
+#include "entity.h"
+#include "spatial_hash_grid.h"
+#include "worker_pool.h"
+
+namespace collision {
+// grid that is rebuilt from scratch every frame with a counting sort instead of
+// being updated per entity. all cells share one packed entity array
+// (compressed sparse row), cell c owns cell_entities[cell_start[c]] up to
+// cell_entities[cell_start[c + 1]] where c = layer * grid_cell_count + cell.
+// the positions of the entries are copied into cell_x and cell_y in the same
+// order, so a cell can be scanned without looking anything up by entity id
+class PackedGrid {
+  static constexpr int packed_cell_count = layer_count * grid_cell_count;
+
+  int cell_start[packed_cell_count + 1]{};
+  int cell_cursor[packed_cell_count]{};
+  std::vector<entity::Entity> cell_entities;
+  std::vector<float> cell_x;
+  std::vector<float> cell_y;
+  std::vector<CellRange> entity_ranges;
+  // cell sizes counted by each task of a parallel rebuild, later the offsets
+  // each task scatters its entities to. packed_cell_count entries per task
+  std::vector<int> task_cells;
+  QueryStamps query_stamps{};
+
+  // stores the cell range of entities[i] and adds it to the cell sizes
+  template <typename Positions, typename PreviousPositions>
+  void CountEntity(const std::vector<entity::Entity>& entities, size_t i,
+                   const Positions& positions,
+                   const PreviousPositions& previous_positions, float w,
+                   float h, int cell_sizes[]) {
+    const auto& pos = positions[entities[i].id];
+    const auto& previous = previous_positions[entities[i].id];
+    const CellRange range = GetCellRange(
+        std::min(pos.x, previous.x) - w, std::min(pos.y, previous.y) - h,
+        std::max(pos.x, previous.x) + w, std::max(pos.y, previous.y) + h);
+    entity_ranges[i] = range;
+    const int layer_start = LayerOf(entities[i].type) * grid_cell_count;
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        cell_sizes[layer_start + CellIndex(col, row)]++;
+      }
+    }
+  }
+
+  // writes entities[i] to the next free slot of every cell it covers
+  template <typename Positions>
+  void ScatterEntity(const std::vector<entity::Entity>& entities, size_t i,
+                     const Positions& positions, int cursors[]) {
+    const CellRange& range = entity_ranges[i];
+    const auto& pos = positions[entities[i].id];
+    const int layer_start = LayerOf(entities[i].type) * grid_cell_count;
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        const int slot = cursors[layer_start + CellIndex(col, row)]++;
+        cell_entities[slot] = entities[i];
+        cell_x[slot] = pos.x;
+        cell_y[slot] = pos.y;
+      }
+    }
+  }
+
+  void ResizeCells() {
+    cell_entities.resize(cell_start[packed_cell_count]);
+    cell_x.resize(cell_start[packed_cell_count]);
+    cell_y.resize(cell_start[packed_cell_count]);
+  }
+
+ public:
+  // positions are indexed by entity id, every entity covers the same box around
+  // its position that SpatialGrid::Update inserts it with
+  template <typename Positions>
+  void Rebuild(const std::vector<entity::Entity>& entities,
+               const Positions& positions, float w, float h) {
+    Rebuild(entities, positions, positions, w, h);
+  }
+
+  // same, but every entity covers the boxes around its previous and its
+  // current position and everything in between, for swept collision tests
+  template <typename Positions, typename PreviousPositions>
+  void Rebuild(const std::vector<entity::Entity>& entities,
+               const Positions& positions,
+               const PreviousPositions& previous_positions, float w, float h) {
+    std::fill(std::begin(cell_start), std::end(cell_start), 0);
+    entity_ranges.resize(entities.size());
+
+    // count pass, cell_start[c + 1] ends up holding the size of cell c
+    for (size_t i = 0; i < entities.size(); i++) {
+      CountEntity(entities, i, positions, previous_positions, w, h,
+                  cell_start + 1);
+    }
+
+    // prefix sum turns the cell sizes into offsets into cell_entities
+    for (int c = 0; c < packed_cell_count; c++) {
+      cell_start[c + 1] += cell_start[c];
+    }
+    ResizeCells();
+    std::copy(cell_start, cell_start + packed_cell_count, cell_cursor);
+
+    // scatter pass
+    for (size_t i = 0; i < entities.size(); i++) {
+      ScatterEntity(entities, i, positions, cell_cursor);
+    }
+  }
+
+  // same on the threads of a pool. the entities are split into one contiguous
+  // range per thread, each range is counted into its own histogram and
+  // scattered behind the ranges before it in every cell, so the cells come out
+  // in the same order as with the single threaded rebuild
+  template <typename Positions, typename PreviousPositions>
+  void Rebuild(const std::vector<entity::Entity>& entities,
+               const Positions& positions,
+               const PreviousPositions& previous_positions, float w, float h,
+               WorkerPool& pool) {
+    const int task_count = pool.GetThreadCount();
+    const size_t task_size = (entities.size() + task_count - 1) / task_count;
+    entity_ranges.resize(entities.size());
+    task_cells.assign((size_t)task_count * packed_cell_count, 0);
+
+    pool.ParallelFor(task_count, [&](int task) {
+      const size_t end = std::min(entities.size(), (task + 1) * task_size);
+      int* cell_sizes = &task_cells[(size_t)task * packed_cell_count];
+      for (size_t i = task * task_size; i < end; i++) {
+        CountEntity(entities, i, positions, previous_positions, w, h,
+                    cell_sizes);
+      }
+    });
+
+    // merges the histograms, the offset of a task in a cell follows the
+    // entities of every earlier task in that cell
+    int offset = 0;
+    for (int c = 0; c < packed_cell_count; c++) {
+      cell_start[c] = offset;
+      for (int task = 0; task < task_count; task++) {
+        int& cell = task_cells[(size_t)task * packed_cell_count + c];
+        const int size = cell;
+        cell = offset;
+        offset += size;
+      }
+    }
+    cell_start[packed_cell_count] = offset;
+    ResizeCells();
+
+    pool.ParallelFor(task_count, [&](int task) {
+      const size_t end = std::min(entities.size(), (task + 1) * task_size);
+      int* cursors = &task_cells[(size_t)task * packed_cell_count];
+      for (size_t i = task * task_size; i < end; i++) {
+        ScatterEntity(entities, i, positions, cursors);
+      }
+    });
+  }
+
+  void Clear() {
+    std::fill(std::begin(cell_start), std::end(cell_start), 0);
+    cell_entities.clear();
+    cell_x.clear();
+    cell_y.clear();
+  }
+
+  // entities of one layer stored in the cell at row * grid_cols + col
+  std::span<const entity::Entity> GetCell(int layer, int cell) const {
+    const int c = layer * grid_cell_count + cell;
+    return {cell_entities.data() + cell_start[c],
+            cell_entities.data() + cell_start[c + 1]};
+  }
+  // positions of the entities returned by GetCell, in the same order
+  std::span<const float> GetCellX(int layer, int cell) const {
+    const int c = layer * grid_cell_count + cell;
+    return {cell_x.data() + cell_start[c], cell_x.data() + cell_start[c + 1]};
+  }
+  std::span<const float> GetCellY(int layer, int cell) const {
+    const int c = layer * grid_cell_count + cell;
+    return {cell_y.data() + cell_start[c], cell_y.data() + cell_start[c + 1]};
+  }
+
+  // same contract as SpatialGrid::ForEachNearbyEntity
+  template <typename Visitor>
+  void ForEachNearbyEntity(LayerMask layers, float x, float y, float x2,
+                           float y2, Visitor&& visit) {
+    query_stamps.NextQuery();
+    const CellRange range = GetCellRange(x, y, x2, y2);
+    for (int layer = 0; layer < layer_count; layer++) {
+      if ((layers & (1u << layer)) == 0) {
+        continue;
+      }
+      const int layer_start = layer * grid_cell_count;
+      for (int row = range.min_row; row <= range.max_row; row++) {
+        for (int col = range.min_col; col <= range.max_col; col++) {
+          const int c = layer_start + CellIndex(col, row);
+          for (int i = cell_start[c]; i < cell_start[c + 1]; i++) {
+            if (query_stamps.Visit(cell_entities[i])) {
+              visit(cell_entities[i]);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  template <typename Visitor>
+  void ForEachNearbyEntityOfType(entity::Type type, float x, float y,
+                                 float x2, float y2, Visitor&& visit) {
+    ForEachNearbyEntity(LayerBit(type), x, y, x2, y2,
+                        std::forward<Visitor>(visit));
+  }
+};
+}  // namespace collision
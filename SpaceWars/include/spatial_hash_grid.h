@@ -1,10 +1,15 @@
 #pragma once
-#include <string>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <span>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "common_math.h"
+#include "components.h"
 #include "constants.h"
 #include "entity.h"
 #include "hasher.h"
@@ -12,121 +17,957 @@
 namespace collision {
 constexpr int grid_cols = 20;
 constexpr int grid_rows = 15;
+constexpr int grid_cell_count = grid_cols * grid_rows;
 constexpr float width_offset = 16.f / constants::kGameWidth;
 constexpr float height_offset = 16.f / constants::kGameHeight;
 constexpr float grid_tile_width = constants::kGameWidth / grid_cols;
 constexpr float grid_tile_height = constants::kGameHeight / grid_rows;
-class SpatialGrid {
-  std::unordered_map<std::string, std::unordered_set<entity::Entity, Hasher>>
-      cells{};
 
-  std::string HashKey(int x, int y) {
-    // return std::format("{};{}", x, y);
-    return std::to_string(x) + ";" + std::to_string(y);
+// every entity type gets its own collision layer, queries pass a mask of the
+// layers they want so cells of other layers are never visited
+using LayerMask = unsigned int;
+constexpr int layer_count = entity::kTypeCount;
+constexpr LayerMask all_layers = (1u << layer_count) - 1;
+
+constexpr int LayerOf(entity::Type type) { return (int)type; }
+constexpr LayerMask LayerBit(entity::Type type) { return 1u << LayerOf(type); }
+
+// inclusive range of cells covered by a box
+struct CellRange {
+  int min_col = 0;
+  int max_col = 0;
+  int min_row = 0;
+  int max_row = 0;
+
+  bool Contains(int col, int row) const {
+    return col >= min_col && col <= max_col && row >= min_row &&
+           row <= max_row;
+  }
+  // true when the ranges share at least one cell
+  bool Overlaps(const CellRange& other) const {
+    return min_col <= other.max_col && other.min_col <= max_col &&
+           min_row <= other.max_row && other.min_row <= max_row;
+  }
+  bool operator==(const CellRange& other) const = default;
+};
+
+// cells covered by the box from x, y to x2, y2 on a cols by rows grid over a
+// width by height area, anything outside the area is clamped into the border
+// cells
+inline CellRange GetCellRange(float x, float y, float x2, float y2, int cols,
+                              int rows, float width, float height) {
+  // input: 0,0,16,16
+  // output: 0,0,0,0
+
+  float min_x = math::Clamp01(x / width);
+  float min_y = math::Clamp01(y / height);
+  float max_x = math::Clamp01(x2 / width);
+  float max_y = math::Clamp01(y2 / height);
+  // a coordinate on the far edge normalizes to 1, keep it in the last cell
+  return {std::min((int)(min_x * cols), cols - 1),
+          std::min((int)(max_x * cols), cols - 1),
+          std::min((int)(min_y * rows), rows - 1),
+          std::min((int)(max_y * rows), rows - 1)};
+}
+
+// how a grid splits the game area into cells. the constants above are the
+// default, SpatialGrid can be given any other resolution at runtime
+struct GridDimensions {
+  int cols = grid_cols;
+  int rows = grid_rows;
+
+  int GetCellCount() const { return cols * rows; }
+  float GetWidth() const { return (float)constants::kGameWidth; }
+  float GetHeight() const { return (float)constants::kGameHeight; }
+  float GetTileWidth() const { return (float)constants::kGameWidth / cols; }
+  float GetTileHeight() const { return (float)constants::kGameHeight / rows; }
+  int CellIndex(int col, int row) const { return row * cols + col; }
+
+  CellRange GetCellRange(float x, float y, float x2, float y2) const {
+    return collision::GetCellRange(x, y, x2, y2, cols, rows, GetWidth(),
+                                   GetHeight());
+  }
+
+  bool operator==(const GridDimensions& other) const = default;
+};
+
+// same interface with the resolution and the covered area fixed at compile
+// time, every cell index and cell range computation works on constants
+template <int grid_cols_, int grid_rows_, int width_ = constants::kGameWidth,
+          int height_ = constants::kGameHeight>
+struct FixedGridDimensions {
+  static constexpr int cols = grid_cols_;
+  static constexpr int rows = grid_rows_;
+
+  static constexpr int GetCellCount() { return cols * rows; }
+  static constexpr float GetWidth() { return (float)width_; }
+  static constexpr float GetHeight() { return (float)height_; }
+  static constexpr float GetTileWidth() { return (float)width_ / cols; }
+  static constexpr float GetTileHeight() { return (float)height_ / rows; }
+  static constexpr int CellIndex(int col, int row) { return row * cols + col; }
+
+  static CellRange GetCellRange(float x, float y, float x2, float y2) {
+    return collision::GetCellRange(x, y, x2, y2, cols, rows, GetWidth(),
+                                   GetHeight());
+  }
+
+  bool operator==(const FixedGridDimensions& other) const = default;
+};
+
+inline int CellIndex(int col, int row) { return row * grid_cols + col; }
+
+inline CellRange GetCellRange(float x, float y, float x2, float y2) {
+  return GridDimensions{}.GetCellRange(x, y, x2, y2);
+}
+
+inline LayerMask ExcludedTypesMask(
+    const std::vector<entity::Type>& types_to_exclude) {
+  LayerMask layers = all_layers;
+  for (const auto type : types_to_exclude) {
+    layers &= ~LayerBit(type);
+  }
+  return layers;
+}
+
+// fraction of the move at which a w by h box moving from x, y by dx, dy starts
+// to overlap the other_w by other_h box at other_x, other_y, -1 when it never
+// does. boxes that only touch do not count, like SDL_HasIntersectionF. a zero
+// sized box makes this a segment test
+inline float SweptEntryTime(float x, float y, float dx, float dy, float w,
+                            float h, float other_x, float other_y,
+                            float other_w, float other_h) {
+  // the boxes overlap while the corner of the moving box is inside the other
+  // box grown by the size of the moving box, clip the move against that box
+  // one axis at a time
+  float enter = 0.f;
+  float exit = 1.f;
+  const auto clip = [&](float start, float delta, float min, float max) {
+    if (delta == 0.f) {
+      return min < start && start < max;
+    }
+    float t0 = (min - start) / delta;
+    float t1 = (max - start) / delta;
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    enter = std::max(enter, t0);
+    exit = std::min(exit, t1);
+    return enter < exit;
+  };
+  if (!clip(x, dx, other_x - w, other_x + other_w) ||
+      !clip(y, dy, other_y - h, other_y + other_h)) {
+    return -1.f;
+  }
+  return enter;
+}
+
+// true when the moving box overlaps the other box at any point of the move,
+// without movement this is the same test as SDL_HasIntersectionF
+inline bool SweptOverlaps(float x, float y, float dx, float dy, float w,
+                          float h, float other_x, float other_y, float other_w,
+                          float other_h) {
+  return SweptEntryTime(x, y, dx, dy, w, h, other_x, other_y, other_w,
+                        other_h) >= 0.f;
+}
+
+// clips the segment from x, y to x2, y2 against the game area, or another
+// width by height area, t_min and t_max are set to the fractions of the
+// segment at which it enters and leaves it. returns false when the segment
+// misses the area
+inline bool ClipSegmentToGrid(float x, float y, float x2, float y2,
+                              float& t_min, float& t_max,
+                              float width = (float)constants::kGameWidth,
+                              float height = (float)constants::kGameHeight) {
+  t_min = 0.f;
+  t_max = 1.f;
+  const auto clip = [&](float start, float delta, float size) {
+    if (delta == 0.f) {
+      return 0.f <= start && start <= size;
+    }
+    float t0 = -start / delta;
+    float t1 = (size - start) / delta;
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    t_min = std::max(t_min, t0);
+    t_max = std::min(t_max, t1);
+    return t_min <= t_max;
+  };
+  return clip(x, x2 - x, width) && clip(y, y2 - y, height);
+}
+
+// walks the cells crossed by the segment from x, y to x2, y2 in order with a
+// 2d dda (amanatides and woo) and calls visit(cell, t) with the index of each
+// cell and the fraction of the segment at which it enters it. the walk stops
+// when visit returns false. only the part of the segment inside the game area
+// is walked, the grid does not resolve anything outside it
+template <typename Dimensions, typename Visitor>
+void ForEachCellAlongSegment(const Dimensions& dimensions, float x, float y,
+                             float x2, float y2, Visitor&& visit) {
+  constexpr float kInfinity = std::numeric_limits<float>::infinity();
+  float t_min, t_max;
+  if (!ClipSegmentToGrid(x, y, x2, y2, t_min, t_max, dimensions.GetWidth(),
+                         dimensions.GetHeight())) {
+    return;
+  }
+  const float dx = x2 - x;
+  const float dy = y2 - y;
+  const float tile_width = dimensions.GetTileWidth();
+  const float tile_height = dimensions.GetTileHeight();
+  int col = std::clamp((int)((x + dx * t_min) / tile_width), 0,
+                       dimensions.cols - 1);
+  int row = std::clamp((int)((y + dy * t_min) / tile_height), 0,
+                       dimensions.rows - 1);
+  const int step_col = dx > 0.f ? 1 : -1;
+  const int step_row = dy > 0.f ? 1 : -1;
+  // fraction of the segment between two cell borders on each axis
+  const float t_delta_x = dx != 0.f ? tile_width / std::abs(dx) : kInfinity;
+  const float t_delta_y = dy != 0.f ? tile_height / std::abs(dy) : kInfinity;
+  // fraction of the segment at which the next cell border is crossed
+  float t_next_x =
+      dx != 0.f ? ((col + (dx > 0.f)) * tile_width - x) / dx : kInfinity;
+  float t_next_y =
+      dy != 0.f ? ((row + (dy > 0.f)) * tile_height - y) / dy : kInfinity;
+
+  float t = t_min;
+  while (visit(dimensions.CellIndex(col, row), t)) {
+    if (t_next_x < t_next_y) {
+      t = t_next_x;
+      t_next_x += t_delta_x;
+      col += step_col;
+    } else {
+      t = t_next_y;
+      t_next_y += t_delta_y;
+      row += step_row;
+    }
+    if (t > t_max || col < 0 || col >= dimensions.cols || row < 0 ||
+        row >= dimensions.rows) {
+      return;
+    }
+  }
+}
+
+template <typename Visitor>
+void ForEachCellAlongSegment(float x, float y, float x2, float y2,
+                             Visitor&& visit) {
+  ForEachCellAlongSegment(GridDimensions{}, x, y, x2, y2,
+                          std::forward<Visitor>(visit));
+}
+
+// entity hit by a segment and the fraction of the segment at which it is hit
+template <typename Payload>
+struct BasicSegmentHit {
+  Payload entity{};
+  float t = 0.f;
+};
+using SegmentHit = BasicSegmentHit<entity::Entity>;
+
+// squared distance from x, y to the closest point of the w by h box at box_x,
+// box_y, 0 when the point is inside the box
+inline float BoxDistanceSq(float x, float y, float box_x, float box_y,
+                           float w, float h) {
+  const float dx = std::max({box_x - x, 0.f, x - (box_x + w)});
+  const float dy = std::max({box_y - y, 0.f, y - (box_y + h)});
+  return dx * dx + dy * dy;
+}
+
+// entity found by a radius or nearest neighbour query and the squared distance
+// from the query point to its box
+template <typename Payload>
+struct BasicNearbyEntity {
+  Payload entity{};
+  float distance_sq = 0.f;
+};
+using NearbyEntity = BasicNearbyEntity<entity::Entity>;
+
+// remembers which entities a query already reported, each entity is stamped
+// with the current query epoch instead of being inserted into a hash set.
+// ids go up to capacity
+template <int capacity>
+class BasicQueryStamps {
+  // last query that reported each entity, indexed by entity id
+  unsigned int stamps[capacity]{};
+  unsigned int epoch = 0;
+
+ public:
+  void NextQuery() {
+    if (++epoch == 0) {
+      // epoch wrapped around, old stamps could collide with new ones
+      std::fill(std::begin(stamps), std::end(stamps), 0u);
+      epoch = 1;
+    }
   }
-  std::vector<int> GetIndices(float x, float y, float x2, float y2) {
-    // input: 0,0,16,16
-    // output: 0,0,1,1
+  // returns true the first time an id is seen during the current query
+  bool Visit(int id) {
+    if (stamps[id] == epoch) {
+      return false;
+    }
+    stamps[id] = epoch;
+    return true;
+  }
+  bool Visit(const entity::Entity& entity) { return Visit(entity.id); }
+};
+using QueryStamps = BasicQueryStamps<constants::kEntityCount>;
+
+// occupancy of a SpatialGrid and how well its queries did since the counters
+// were last reset
+struct GridStats {
+  // entities per cell, over the cells holding at least one
+  float mean_per_cell = 0.f;
+  int max_per_cell = 0;
+  int occupied_cells = 0;
+  int queries = 0;
+  float candidates_per_query = 0.f;
+  // fraction of the candidates reported by RecordHits as real hits
+  float hit_fraction = 0.f;
+};
+
+// how a grid gets at the id and the layer of what it stores. ids index the per
+// entity arrays of the grid and the positions passed to its queries, they
+// have to stay below capacity
+template <typename Payload>
+struct PayloadTraits;
+
+template <>
+struct PayloadTraits<entity::Entity> {
+  static constexpr int capacity = constants::kEntityCount;
+  static constexpr int layer_count = collision::layer_count;
+  using Hash = Hasher;
+
+  static int IdOf(const entity::Entity& entity) { return entity.id; }
+  static int LayerOf(const entity::Entity& entity) {
+    return collision::LayerOf(entity.type);
+  }
+};
+
+// storage policies of BasicSpatialGrid. both hand out the entities of one
+// cell of one layer, cells are numbered by the CellIndex of the dimensions
+
+// one vector per cell, allocated up front. the default, cell lookups are a
+// plain array index
+template <typename Payload, int layer_count>
+class FlatCellStorage {
+  std::vector<std::vector<Payload>> cells[layer_count];
 
-    float min_x = math::Clamp01(x / constants::kGameWidth);
-    float min_y = math::Clamp01(y / constants::kGameHeight);
-    float max_x = math::Clamp01(x2 / constants::kGameWidth);
-    float max_y = math::Clamp01(y2 / constants::kGameHeight);
-    std::vector<int> indices = {
-        (int)(min_x * grid_cols), (int)(max_x * grid_cols),
-        (int)(min_y * grid_rows), (int)(max_y * grid_rows)};
-    return indices;
+ public:
+  // drops every cell and makes room for cell_count per layer
+  void Reset(int cell_count) {
+    for (auto& layer_cells : cells) {
+      layer_cells.assign(cell_count, {});
+    }
+  }
+  std::vector<Payload>& GetCell(int layer, int cell) {
+    return cells[layer][cell];
   }
-  // insert the client into every cell that it occupies
-  void Insert(const entity::Entity& entity, const std::vector<int>& indices) {
-    for (int i = indices[0]; i <= indices[1]; i++) {
-      for (int j = indices[2]; j <= indices[3]; j++) {
-        auto key = HashKey(i, j);
-        cells[key].insert(entity);
+  std::span<const Payload> FindCell(int layer, int cell) const {
+    return cells[layer][cell];
+  }
+  // empties the cells but keeps their memory
+  void Clear() {
+    for (auto& layer_cells : cells) {
+      for (auto& cell : layer_cells) {
+        cell.clear();
       }
     }
   }
+};
+
+// only cells that were ever occupied are allocated, for fine grids or large
+// areas where most cells stay empty. lookups go through a hash map
+template <typename Payload, int layer_count>
+class HashCellStorage {
+  std::unordered_map<int, std::vector<Payload>> cells[layer_count];
 
  public:
-  std::unordered_set<entity::Entity, Hasher> FindNearbyEntities(
-      std::vector<entity::Type> types_to_exclude, float x, float y, float w,
-      float h) {
-    std::unordered_set<entity::Entity, Hasher> entity_set = {};
-    std::vector<int> indices = GetIndices(x, y, w, h);
-    for (int i = indices[0]; i <= indices[1]; i++) {
-      for (int j = indices[2]; j <= indices[3]; j++) {
-        const auto key = HashKey(i, j);
-        if (cells[key].empty()) {
-          continue;
-        }
-        for (const auto& entity : cells[key]) {
-          if (std::find(types_to_exclude.begin(), types_to_exclude.end(),
-                        entity.type) != types_to_exclude.end()) {
-            continue;
+  void Reset(int) {
+    for (auto& layer_cells : cells) {
+      layer_cells.clear();
+    }
+  }
+  std::vector<Payload>& GetCell(int layer, int cell) {
+    return cells[layer][cell];
+  }
+  std::span<const Payload> FindCell(int layer, int cell) const {
+    const auto it = cells[layer].find(cell);
+    if (it == cells[layer].end()) {
+      return {};
+    }
+    return it->second;
+  }
+  void Clear() {
+    for (auto& layer_cells : cells) {
+      for (auto& [cell, entities] : layer_cells) {
+        entities.clear();
+      }
+    }
+  }
+};
+
+// grid over the game area that entities are moved between incrementally.
+// Payload is what the cells store, PayloadTraits tells the grid its id and
+// layer. Dimensions is GridDimensions for a resolution that can change at
+// runtime or FixedGridDimensions to fold the cell math into constants, and
+// Storage is FlatCellStorage or HashCellStorage
+template <typename Payload, typename Dimensions = GridDimensions,
+          template <typename, int> class Storage = FlatCellStorage>
+class BasicSpatialGrid {
+  using Traits = PayloadTraits<Payload>;
+  static constexpr int layer_count = Traits::layer_count;
+  using SegmentHit = BasicSegmentHit<Payload>;
+  using NearbyEntity = BasicNearbyEntity<Payload>;
+
+  // the box an entity was last inserted with, kept so the grid can re-bucket
+  // its entities when it is resized
+  struct InsertedBox {
+    Payload entity{};
+    float x = 0;
+    float y = 0;
+    float x2 = 0;
+    float y2 = 0;
+  };
+
+  Dimensions dimensions{};
+  // cells are stored per layer and row major, a cell is found at
+  // cells.GetCell(layer, row * dimensions.cols + col)
+  Storage<Payload, layer_count> cells{};
+  BasicQueryStamps<Traits::capacity> query_stamps{};
+
+  // cell range every entity currently occupies, indexed by entity id. only
+  // valid while is_inserted is set for that entity
+  CellRange entity_ranges[Traits::capacity]{};
+  InsertedBox inserted_boxes[Traits::capacity]{};
+  bool is_inserted[Traits::capacity]{};
+  // query counters behind GetStats
+  int query_count = 0;
+  int candidate_count = 0;
+  int hit_count = 0;
+  // reused by HasLineOfSight and FindNearestEntity so they do not allocate
+  std::vector<SegmentHit> segment_hits;
+  std::vector<NearbyEntity> nearest_entities;
+
+  void InsertIntoCell(const Payload& entity, int col, int row) {
+    cells.GetCell(Traits::LayerOf(entity), dimensions.CellIndex(col, row))
+        .emplace_back(entity);
+  }
+
+  void RemoveFromCell(const Payload& entity, int col, int row) {
+    auto& cell =
+        cells.GetCell(Traits::LayerOf(entity), dimensions.CellIndex(col, row));
+    auto it = std::find(cell.begin(), cell.end(), entity);
+    if (it == cell.end()) {
+      return;
+    }
+    // order inside a cell does not matter, swap with the last and pop
+    *it = cell.back();
+    cell.pop_back();
+  }
+
+  void InsertIntoCells(const Payload& entity, const CellRange& range) {
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        InsertIntoCell(entity, col, row);
+      }
+    }
+  }
+
+ public:
+  explicit BasicSpatialGrid(Dimensions dimensions = {}) {
+    Resize(dimensions);
+  }
+
+  const Dimensions& GetDimensions() const { return dimensions; }
+
+  // switches to another resolution and re-buckets every inserted entity under
+  // the box it was last updated with
+  void Resize(Dimensions new_dimensions) {
+    dimensions = new_dimensions;
+    cells.Reset(dimensions.GetCellCount());
+    for (int id = 0; id < Traits::capacity; id++) {
+      if (!is_inserted[id]) {
+        continue;
+      }
+      const InsertedBox& box = inserted_boxes[id];
+      entity_ranges[id] =
+          dimensions.GetCellRange(box.x, box.y, box.x2, box.y2);
+      InsertIntoCells(box.entity, entity_ranges[id]);
+    }
+  }
+
+  // calls visit once for every entity of the given layers in the cells
+  // overlapped by the box, duplicates from entities spanning several cells are
+  // skipped by stamping each entity with the current query epoch instead of
+  // hashing it
+  template <typename Visitor>
+  void ForEachNearbyEntity(LayerMask layers, float x, float y, float x2,
+                           float y2, Visitor&& visit) {
+    query_stamps.NextQuery();
+    query_count++;
+    const CellRange range = dimensions.GetCellRange(x, y, x2, y2);
+    for (int layer = 0; layer < layer_count; layer++) {
+      if ((layers & (1u << layer)) == 0) {
+        continue;
+      }
+      for (int row = range.min_row; row <= range.max_row; row++) {
+        for (int col = range.min_col; col <= range.max_col; col++) {
+          for (const auto& entity :
+               cells.FindCell(layer, dimensions.CellIndex(col, row))) {
+            if (query_stamps.Visit(Traits::IdOf(entity))) {
+              candidate_count++;
+              visit(entity);
+            }
           }
-          entity_set.insert(entity);
         }
       }
     }
+  }
+
+  template <typename Visitor>
+  void ForEachNearbyEntityOfType(entity::Type type, float x, float y,
+                                 float x2, float y2, Visitor&& visit) {
+    ForEachNearbyEntity(LayerBit(type), x, y, x2, y2,
+                        std::forward<Visitor>(visit));
+  }
+
+  // fills a caller owned buffer, reusing it between queries keeps them
+  // allocation free once it has grown to the largest result
+  void FindNearbyEntities(LayerMask layers, float x, float y, float w, float h,
+                          std::vector<Payload>& result) {
+    result.clear();
+    ForEachNearbyEntity(
+        layers, x, y, w, h,
+        [&](const Payload& entity) { result.emplace_back(entity); });
+  }
+
+  void FindNearbyEntities(const std::vector<entity::Type>& types_to_exclude,
+                          float x, float y, float w, float h,
+                          std::vector<Payload>& result) {
+    FindNearbyEntities(ExcludedTypesMask(types_to_exclude), x, y, w, h,
+                       result);
+  }
+
+  void FindNearbyEntitiesOfType(entity::Type type, float x, float y, float w,
+                                float h, std::vector<Payload>& result) {
+    FindNearbyEntities(LayerBit(type), x, y, w, h, result);
+  }
+
+  std::unordered_set<Payload, typename Traits::Hash> FindNearbyEntities(
+      LayerMask layers, float x, float y, float w, float h) {
+    std::unordered_set<Payload, typename Traits::Hash> entity_set = {};
+    ForEachNearbyEntity(
+        layers, x, y, w, h,
+        [&](const Payload& entity) { entity_set.insert(entity); });
     return entity_set;
   }
 
-  std::unordered_set<entity::Entity, Hasher> FindNearbyEntitiesOfType(
+  std::unordered_set<Payload, typename Traits::Hash> FindNearbyEntities(
+      const std::vector<entity::Type>& types_to_exclude, float x, float y,
+      float w, float h) {
+    return FindNearbyEntities(ExcludedTypesMask(types_to_exclude), x, y, w, h);
+  }
+
+  std::unordered_set<Payload, typename Traits::Hash> FindNearbyEntitiesOfType(
       entity::Type type, float x, float y, float w, float h) {
-    std::unordered_set<entity::Entity, Hasher> entity_set = {};
-    std::vector<int> indices = GetIndices(x, y, w, h);
-    for (int i = indices[0]; i <= indices[1]; i++) {
-      for (int j = indices[2]; j <= indices[3]; j++) {
-        const auto key = HashKey(i, j);
-        if (cells[key].empty()) {
+    return FindNearbyEntities(LayerBit(type), x, y, w, h);
+  }
+
+  // finds the first max_hits entities of the given layers hit by the segment
+  // from x, y to x2, y2, ordered along it. entities are w by h boxes extending
+  // from their position in positions, indexed by entity id, to the bottom
+  // right. only the cells along the segment are visited and the walk stops as
+  // soon as no later cell can hold a closer hit. like the walk, hits are only
+  // searched inside the game area, a box the segment enters off screen is hit
+  // where the segment enters the game area
+  template <typename Positions>
+  void CastSegment(LayerMask layers, float x, float y, float x2, float y2,
+                   const Positions& positions, float w, float h, int max_hits,
+                   std::vector<SegmentHit>& hits) {
+    hits.clear();
+    if (max_hits <= 0) {
+      return;
+    }
+    // hits are only searched on the part of the segment the grid covers
+    float t_min, t_max;
+    if (!ClipSegmentToGrid(x, y, x2, y2, t_min, t_max, dimensions.GetWidth(),
+                           dimensions.GetHeight())) {
+      return;
+    }
+    query_stamps.NextQuery();
+    const float dx = x2 - x;
+    const float dy = y2 - y;
+    const float clip_x = x + dx * t_min;
+    const float clip_y = y + dy * t_min;
+    const float clip_dx = dx * (t_max - t_min);
+    const float clip_dy = dy * (t_max - t_min);
+    // entry fraction of the previous cell, a hit before it is final because
+    // the cell holding its entry point has been visited even when rounding
+    // put that point on the wrong side of a cell border
+    float final_t = 0.f;
+    ForEachCellAlongSegment(dimensions, x, y, x2, y2, [&](int cell, float t) {
+      int final_hits = 0;
+      for (const auto& hit : hits) {
+        final_hits += hit.t < final_t;
+      }
+      if (final_hits >= max_hits) {
+        return false;
+      }
+      final_t = t;
+      for (int layer = 0; layer < layer_count; layer++) {
+        if ((layers & (1u << layer)) == 0) {
           continue;
         }
-        for (const auto& entity : cells[key]) {
-          if (entity.type != type) {
+        for (const auto& entity : cells.FindCell(layer, cell)) {
+          if (!query_stamps.Visit(Traits::IdOf(entity))) {
             continue;
           }
-          entity_set.insert(entity);
+          const auto& pos = positions[Traits::IdOf(entity)];
+          const float hit_t = SweptEntryTime(clip_x, clip_y, clip_dx,
+                                             clip_dy, 0.f, 0.f, pos.x, pos.y,
+                                             w, h);
+          if (hit_t >= 0.f) {
+            hits.push_back({entity, t_min + hit_t * (t_max - t_min)});
+          }
         }
       }
+      return true;
+    });
+    std::sort(hits.begin(), hits.end(),
+              [](const SegmentHit& a, const SegmentHit& b) {
+                if (a.t != b.t) {
+                  return a.t < b.t;
+                }
+                return Traits::IdOf(a.entity) < Traits::IdOf(b.entity);
+              });
+    if ((int)hits.size() > max_hits) {
+      hits.resize(max_hits);
     }
-    return entity_set;
   }
 
-  //    check all the cells that the client occupies
-  //    and return all the other clients that occupy the same
-  //
+  template <typename Positions>
+  void CastSegmentOfType(entity::Type type, float x, float y, float x2,
+                         float y2, const Positions& positions, float w,
+                         float h, int max_hits,
+                         std::vector<SegmentHit>& hits) {
+    CastSegment(LayerBit(type), x, y, x2, y2, positions, w, h, max_hits, hits);
+  }
 
-  void Update(const entity::Entity& entity, float x, float y, float w,
-              float h) {
-    Remove(entity,
-           GetIndices(x - w * 1.1f, y - h * 1.1f, x + w * 1.1f, y + h * 1.1f));
-    Insert(entity, GetIndices(x - w, y - h, x + w, y + h));
+  // true when no entity of the given layers blocks the segment
+  template <typename Positions>
+  bool HasLineOfSight(LayerMask layers, float x, float y, float x2, float y2,
+                      const Positions& positions, float w, float h) {
+    CastSegment(layers, x, y, x2, y2, positions, w, h, 1, segment_hits);
+    return segment_hits.empty();
   }
 
-  void Remove(const entity::Entity& entity, const std::vector<int>& indices) {
-    for (int i = indices[0]; i <= indices[1]; i++) {
-      for (int j = indices[2]; j <= indices[3]; j++) {
-        auto key = HashKey(i, j);
-        if (cells.find(key) == cells.end()) {
+  // calls visit(entity, distance_sq) once for every entity of the given layers
+  // whose box reaches into the circle around x, y. boxes are w by h and extend
+  // from their position in positions, indexed by entity id, to the bottom
+  // right. cells outside the circle are skipped
+  template <typename Positions, typename Visitor>
+  void ForEachEntityInRadius(LayerMask layers, float x, float y, float radius,
+                             const Positions& positions, float w, float h,
+                             Visitor&& visit) {
+    query_stamps.NextQuery();
+    const float radius_sq = radius * radius;
+    const float tile_width = dimensions.GetTileWidth();
+    const float tile_height = dimensions.GetTileHeight();
+    const CellRange range = dimensions.GetCellRange(x - radius, y - radius,
+                                                    x + radius, y + radius);
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        // border cells also hold everything clamped into them
+        if (col > 0 && col < dimensions.cols - 1 && row > 0 &&
+            row < dimensions.rows - 1 &&
+            BoxDistanceSq(x, y, col * tile_width - 1.f,
+                          row * tile_height - 1.f, tile_width + 2.f,
+                          tile_height + 2.f) > radius_sq) {
           continue;
         }
-        cells[key].erase(entity);
+        for (int layer = 0; layer < layer_count; layer++) {
+          if ((layers & (1u << layer)) == 0) {
+            continue;
+          }
+          for (const auto& entity :
+               cells.FindCell(layer, dimensions.CellIndex(col, row))) {
+            if (!query_stamps.Visit(Traits::IdOf(entity))) {
+              continue;
+            }
+            const auto& pos = positions[Traits::IdOf(entity)];
+            const float distance_sq = BoxDistanceSq(x, y, pos.x, pos.y, w, h);
+            if (distance_sq <= radius_sq) {
+              visit(entity, distance_sq);
+            }
+          }
+        }
       }
     }
   }
-  void Remove(const entity::Entity& entity, float x, float y, float w,
-              float h) {
-    const std::vector<int>& indices =
-        GetIndices(x - w * 1.1f, y - h * 1.1f, x + w * 1.1f, y + h * 1.1f);
-    for (int i = indices[0]; i <= indices[1]; i++) {
-      for (int j = indices[2]; j <= indices[3]; j++) {
-        auto key = HashKey(i, j);
-        if (cells.find(key) == cells.end()) {
+
+  // fills a caller owned buffer like FindNearbyEntities
+  template <typename Positions>
+  void FindEntitiesInRadius(LayerMask layers, float x, float y, float radius,
+                            const Positions& positions, float w, float h,
+                            std::vector<NearbyEntity>& result) {
+    result.clear();
+    ForEachEntityInRadius(layers, x, y, radius, positions, w, h,
+                          [&](const Payload& entity, float distance_sq) {
+                            result.push_back({entity, distance_sq});
+                          });
+  }
+
+  // finds the k entities of the given layers whose boxes are closest to x, y,
+  // nearest first, into a caller owned buffer. boxes are laid out like for
+  // ForEachEntityInRadius. the cells are searched in square rings around the
+  // cell of x, y and the search stops once the k-th distance is shorter than
+  // the distance to any cell outside the rings searched so far
+  template <typename Positions>
+  void FindNearestEntities(LayerMask layers, float x, float y, int k,
+                           const Positions& positions, float w, float h,
+                           std::vector<NearbyEntity>& result) {
+    result.clear();
+    if (k <= 0) {
+      return;
+    }
+    query_stamps.NextQuery();
+    const float tile_width = dimensions.GetTileWidth();
+    const float tile_height = dimensions.GetTileHeight();
+    const CellRange start = dimensions.GetCellRange(x, y, x, y);
+    const auto visit_cell = [&](int col, int row) {
+      for (int layer = 0; layer < layer_count; layer++) {
+        if ((layers & (1u << layer)) == 0) {
           continue;
         }
-        cells[key].erase(entity);
+        for (const auto& entity :
+             cells.FindCell(layer, dimensions.CellIndex(col, row))) {
+          if (!query_stamps.Visit(Traits::IdOf(entity))) {
+            continue;
+          }
+          const auto& pos = positions[Traits::IdOf(entity)];
+          const float distance_sq = BoxDistanceSq(x, y, pos.x, pos.y, w, h);
+          if ((int)result.size() == k) {
+            if (distance_sq >= result.back().distance_sq) {
+              continue;
+            }
+            result.pop_back();
+          }
+          // keep the buffer sorted, k is small
+          auto it = std::upper_bound(
+              result.begin(), result.end(), distance_sq,
+              [](float value, const NearbyEntity& nearby) {
+                return value < nearby.distance_sq;
+              });
+          result.insert(it, {entity, distance_sq});
+        }
+      }
+    };
+
+    for (int ring = 0;; ring++) {
+      const int min_col = start.min_col - ring;
+      const int max_col = start.min_col + ring;
+      const int min_row = start.min_row - ring;
+      const int max_row = start.min_row + ring;
+      for (int col = std::max(min_col, 0);
+           col <= std::min(max_col, dimensions.cols - 1); col++) {
+        if (min_row >= 0) {
+          visit_cell(col, min_row);
+        }
+        if (ring > 0 && max_row < dimensions.rows) {
+          visit_cell(col, max_row);
+        }
+      }
+      for (int row = std::max(min_row + 1, 0);
+           row <= std::min(max_row - 1, dimensions.rows - 1); row++) {
+        if (ring > 0 && min_col >= 0) {
+          visit_cell(min_col, row);
+        }
+        if (ring > 0 && max_col < dimensions.cols) {
+          visit_cell(max_col, row);
+        }
+      }
+
+      // anything not found yet lies outside the searched square. sides that
+      // reached the border of the grid cover everything clamped into it, the
+      // rest get a pixel of slack for rounding in GetCellRange
+      constexpr float kInfinity = std::numeric_limits<float>::infinity();
+      const float left =
+          min_col <= 0 ? kInfinity : x - min_col * tile_width - 1.f;
+      const float right = max_col >= dimensions.cols - 1
+                              ? kInfinity
+                              : (max_col + 1) * tile_width - x - 1.f;
+      const float top =
+          min_row <= 0 ? kInfinity : y - min_row * tile_height - 1.f;
+      const float bottom = max_row >= dimensions.rows - 1
+                               ? kInfinity
+                               : (max_row + 1) * tile_height - y - 1.f;
+      const float unsearched = std::min({left, right, top, bottom});
+      if (unsearched == kInfinity) {
+        return;
+      }
+      if ((int)result.size() == k && unsearched > 0.f &&
+          result.back().distance_sq <= unsearched * unsearched) {
+        return;
       }
     }
   }
+
+  // nearest entity of the given layers, returns false when there is none
+  template <typename Positions>
+  bool FindNearestEntity(LayerMask layers, float x, float y,
+                         const Positions& positions, float w, float h,
+                         NearbyEntity& nearest) {
+    FindNearestEntities(layers, x, y, 1, positions, w, h, nearest_entities);
+    if (nearest_entities.empty()) {
+      return false;
+    }
+    nearest = nearest_entities.front();
+    return true;
+  }
+
+  // moves the entity to the cells covered by a box of twice its size centered
+  // on x, y. only the cells it leaves and the cells it enters are touched
+  void Update(const Payload& entity, float x, float y, float w, float h) {
+    const CellRange range =
+        dimensions.GetCellRange(x - w, y - h, x + w, y + h);
+    const int id = Traits::IdOf(entity);
+    inserted_boxes[id] = {entity, x - w, y - h, x + w, y + h};
+    if (!is_inserted[id]) {
+      InsertIntoCells(entity, range);
+      entity_ranges[id] = range;
+      is_inserted[id] = true;
+      return;
+    }
+
+    const CellRange old_range = entity_ranges[id];
+    if (old_range == range) {
+      return;
+    }
+    for (int row = old_range.min_row; row <= old_range.max_row; row++) {
+      for (int col = old_range.min_col; col <= old_range.max_col; col++) {
+        if (!range.Contains(col, row)) {
+          RemoveFromCell(entity, col, row);
+        }
+      }
+    }
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        if (!old_range.Contains(col, row)) {
+          InsertIntoCell(entity, col, row);
+        }
+      }
+    }
+    entity_ranges[id] = range;
+  }
+
+  // removes the entity from every cell it occupies, does nothing if it is not
+  // in the grid
+  void Remove(const Payload& entity) {
+    const int id = Traits::IdOf(entity);
+    if (!is_inserted[id]) {
+      return;
+    }
+    const CellRange& range = entity_ranges[id];
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        RemoveFromCell(entity, col, row);
+      }
+    }
+    is_inserted[id] = false;
+  }
+
+  bool Contains(const Payload& entity) const {
+    return is_inserted[Traits::IdOf(entity)];
+  }
+
+  void Clear() {
+    cells.Clear();
+    std::fill(std::begin(is_inserted), std::end(is_inserted), false);
+  }
+
+  // tells the stats how many of the candidates of the last queries were hits
+  void RecordHits(int hits) { hit_count += hits; }
+
+  void ResetStats() {
+    query_count = 0;
+    candidate_count = 0;
+    hit_count = 0;
+  }
+
+  GridStats GetStats() const {
+    GridStats stats;
+    int entries = 0;
+    for (int cell = 0; cell < dimensions.GetCellCount(); cell++) {
+      int cell_entries = 0;
+      for (int layer = 0; layer < layer_count; layer++) {
+        cell_entries += (int)cells.FindCell(layer, cell).size();
+      }
+      if (cell_entries > 0) {
+        entries += cell_entries;
+        stats.occupied_cells++;
+        stats.max_per_cell = std::max(stats.max_per_cell, cell_entries);
+      }
+    }
+    if (stats.occupied_cells > 0) {
+      stats.mean_per_cell = (float)entries / stats.occupied_cells;
+    }
+    stats.queries = query_count;
+    if (query_count > 0) {
+      stats.candidates_per_query = (float)candidate_count / query_count;
+    }
+    if (candidate_count > 0) {
+      stats.hit_fraction = (float)hit_count / candidate_count;
+    }
+    return stats;
+  }
+
+  // debug check, compares every cell against a brute force rebuild from the
+  // given entities and positions (indexed by entity id). returns false if the
+  // grid holds stale, duplicate or missing entries
+  template <typename Positions>
+  bool IsConsistent(const std::vector<Payload>& entities,
+                    const Positions& positions, float w, float h) const {
+    const int cell_count = dimensions.GetCellCount();
+    std::vector<std::vector<int>> expected(layer_count * cell_count);
+    int inserted_count = 0;
+    for (const auto& entity : entities) {
+      const int id = Traits::IdOf(entity);
+      const auto& pos = positions[id];
+      const CellRange range =
+          dimensions.GetCellRange(pos.x - w, pos.y - h, pos.x + w, pos.y + h);
+      if (!is_inserted[id] || !(entity_ranges[id] == range)) {
+        return false;
+      }
+      inserted_count++;
+      for (int row = range.min_row; row <= range.max_row; row++) {
+        for (int col = range.min_col; col <= range.max_col; col++) {
+          expected[Traits::LayerOf(entity) * cell_count +
+                   dimensions.CellIndex(col, row)]
+              .emplace_back(id);
+        }
+      }
+    }
+    if (std::count(std::begin(is_inserted), std::end(is_inserted), true) !=
+        inserted_count) {
+      return false;
+    }
+
+    std::vector<int> actual;
+    for (int layer = 0; layer < layer_count; layer++) {
+      for (int cell = 0; cell < cell_count; cell++) {
+        actual.clear();
+        for (const auto& entity : cells.FindCell(layer, cell)) {
+          actual.emplace_back(Traits::IdOf(entity));
+        }
+        auto& wanted = expected[layer * cell_count + cell];
+        std::sort(actual.begin(), actual.end());
+        std::sort(wanted.begin(), wanted.end());
+        if (actual != wanted) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
 };
+
+// the grid main.cpp keeps its entities in, resolution changeable at runtime
+using SpatialGrid = BasicSpatialGrid<entity::Entity>;
 }  // namespace collision
@@ -0,0 +1,202 @@
+#pragma once
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "constants.h"
+#include "entity.h"
+#include "spatial_hash_grid.h"
+
+namespace collision {
+// broadphase that keeps the boxes of every layer sorted along the x axis.
+// entities barely move between frames so the arrays are re-sorted with an
+// insertion sort, which is close to linear when the order is mostly kept.
+// unlike the grid it does not degrade when everything clumps into a few cells
+class SweepAndPrune {
+  struct Proxy {
+    float min_x = 0;
+    float max_x = 0;
+    float min_y = 0;
+    float max_y = 0;
+    entity::Entity entity{};
+  };
+  static constexpr int kRemovedId = -1;
+
+  // sorted by min_x once SortLayer has run
+  std::vector<Proxy> proxies[layer_count];
+  bool is_sorted[layer_count]{};
+  // widest proxy of each layer, bounds how far left of a query box a proxy
+  // overlapping it can start
+  float max_width[layer_count]{};
+  // index into proxies of every inserted entity, -1 when it is not inserted
+  int proxy_index[constants::kEntityCount];
+  std::vector<Proxy*> active_a;
+  std::vector<Proxy*> active_b;
+
+  void SortLayer(int layer) {
+    if (is_sorted[layer]) {
+      return;
+    }
+    auto& layer_proxies = proxies[layer];
+    layer_proxies.erase(
+        std::remove_if(layer_proxies.begin(), layer_proxies.end(),
+                       [](const Proxy& proxy) {
+                         return proxy.entity.id == kRemovedId;
+                       }),
+        layer_proxies.end());
+    float width = 0;
+    for (size_t i = 1; i < layer_proxies.size(); i++) {
+      Proxy proxy = layer_proxies[i];
+      size_t j = i;
+      while (j > 0 && layer_proxies[j - 1].min_x > proxy.min_x) {
+        layer_proxies[j] = layer_proxies[j - 1];
+        j--;
+      }
+      layer_proxies[j] = proxy;
+    }
+    for (int i = 0; i < (int)layer_proxies.size(); i++) {
+      const auto& proxy = layer_proxies[i];
+      proxy_index[proxy.entity.id] = i;
+      width = std::max(width, proxy.max_x - proxy.min_x);
+    }
+    max_width[layer] = width;
+    is_sorted[layer] = true;
+  }
+
+  static bool OverlapsY(const Proxy& a, const Proxy& b) {
+    return a.min_y <= b.max_y && a.max_y >= b.min_y;
+  }
+
+ public:
+  SweepAndPrune() {
+    std::fill(std::begin(proxy_index), std::end(proxy_index), -1);
+  }
+
+  // covers the same box around x, y as SpatialGrid::Update
+  void Update(const entity::Entity& entity, float x, float y, float w,
+              float h) {
+    const int layer = LayerOf(entity.type);
+    const Proxy proxy = {x - w, x + w, y - h, y + h, entity};
+    int& index = proxy_index[entity.id];
+    if (index < 0) {
+      index = (int)proxies[layer].size();
+      proxies[layer].emplace_back(proxy);
+      is_sorted[layer] = false;
+      return;
+    }
+    auto& current = proxies[layer][index];
+    if (current.min_x != proxy.min_x) {
+      is_sorted[layer] = false;
+    }
+    current = proxy;
+    max_width[layer] = std::max(max_width[layer], proxy.max_x - proxy.min_x);
+  }
+
+  // does nothing if the entity is not inserted
+  void Remove(const entity::Entity& entity) {
+    int& index = proxy_index[entity.id];
+    if (index < 0) {
+      return;
+    }
+    // removed proxies are dropped by the next sort so the order is kept
+    const int layer = LayerOf(entity.type);
+    proxies[layer][index].entity.id = kRemovedId;
+    is_sorted[layer] = false;
+    index = -1;
+  }
+
+  bool Contains(const entity::Entity& entity) const {
+    return proxy_index[entity.id] >= 0;
+  }
+
+  void Clear() {
+    for (int layer = 0; layer < layer_count; layer++) {
+      proxies[layer].clear();
+      is_sorted[layer] = true;
+      max_width[layer] = 0;
+    }
+    std::fill(std::begin(proxy_index), std::end(proxy_index), -1);
+  }
+
+  // same contract as SpatialGrid::ForEachNearbyEntity, but only entities whose
+  // box overlaps the query box are visited
+  template <typename Visitor>
+  void ForEachNearbyEntity(LayerMask layers, float x, float y, float x2,
+                           float y2, Visitor&& visit) {
+    for (int layer = 0; layer < layer_count; layer++) {
+      if ((layers & (1u << layer)) == 0) {
+        continue;
+      }
+      SortLayer(layer);
+      const auto& layer_proxies = proxies[layer];
+      const float start_x = x - max_width[layer];
+      auto it = std::lower_bound(
+          layer_proxies.begin(), layer_proxies.end(), start_x,
+          [](const Proxy& proxy, float value) { return proxy.min_x < value; });
+      for (; it != layer_proxies.end() && it->min_x <= x2; ++it) {
+        if (it->max_x >= x && it->min_y <= y2 && it->max_y >= y) {
+          visit(it->entity);
+        }
+      }
+    }
+  }
+
+  template <typename Visitor>
+  void ForEachNearbyEntityOfType(entity::Type type, float x, float y,
+                                 float x2, float y2, Visitor&& visit) {
+    ForEachNearbyEntity(LayerBit(type), x, y, x2, y2,
+                        std::forward<Visitor>(visit));
+  }
+
+  // sweeps the sorted arrays of both types at once and calls
+  // visit(a_entity, b_entity) for every pair of overlapping boxes
+  template <typename Visitor>
+  void ForEachOverlappingPair(entity::Type a_type, entity::Type b_type,
+                              Visitor&& visit) {
+    const int a_layer = LayerOf(a_type);
+    const int b_layer = LayerOf(b_type);
+    SortLayer(a_layer);
+    SortLayer(b_layer);
+    auto& a_proxies = proxies[a_layer];
+    auto& b_proxies = proxies[b_layer];
+    active_a.clear();
+    active_b.clear();
+
+    // drops every active proxy that ends before the sweep position
+    const auto prune = [](std::vector<Proxy*>& active, float sweep_x) {
+      active.erase(std::remove_if(active.begin(), active.end(),
+                                  [sweep_x](const Proxy* proxy) {
+                                    return proxy->max_x < sweep_x;
+                                  }),
+                   active.end());
+    };
+
+    size_t a = 0;
+    size_t b = 0;
+    while (a < a_proxies.size() || b < b_proxies.size()) {
+      const bool take_a =
+          b >= b_proxies.size() ||
+          (a < a_proxies.size() && a_proxies[a].min_x <= b_proxies[b].min_x);
+      if (take_a) {
+        Proxy& proxy = a_proxies[a++];
+        prune(active_b, proxy.min_x);
+        for (const Proxy* other : active_b) {
+          if (OverlapsY(proxy, *other)) {
+            visit(proxy.entity, other->entity);
+          }
+        }
+        active_a.emplace_back(&proxy);
+      } else {
+        Proxy& proxy = b_proxies[b++];
+        prune(active_a, proxy.min_x);
+        for (const Proxy* other : active_a) {
+          if (OverlapsY(proxy, *other)) {
+            visit(other->entity, proxy.entity);
+          }
+        }
+        active_b.emplace_back(&proxy);
+      }
+    }
+  }
+};
+}  // namespace collision
@@ -0,0 +1,261 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "worker_pool.h"
+
+// runs the systems of a frame, each declaring what it reads and what it
+// writes as bits of a mask (components, or any other state the caller gives
+// a bit). Build works out once which systems have to wait for which: a system
+// depends on every system added before it that writes something it reads or
+// writes, or reads something it writes. Run then hands each system to a
+// thread of a pool once the systems it depends on are done, threads with
+// nothing ready sleep, so systems touching separate state run at the same
+// time and the results match running them one after another
+class SystemScheduler {
+ public:
+  using Mask = uint64_t;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct System {
+    std::string name;
+    Mask reads = 0;
+    Mask writes = 0;
+    std::function<void()> run;
+    // earlier systems this one waits for and later ones waiting for it
+    std::vector<int> dependencies;
+    std::vector<int> dependents;
+  };
+
+  // when a system ran in the last frame and on which thread
+  struct Span {
+    Clock::time_point start;
+    Clock::time_point end;
+    std::thread::id thread;
+  };
+
+  std::vector<System> systems;
+  // most systems that can run at the same time
+  int width = 1;
+  std::vector<Span> timeline;
+  Clock::time_point frame_start;
+
+  // state of a parallel Run, guarded by mutex
+  std::mutex mutex;
+  std::condition_variable ready_changed;
+  // dependencies of every system not done yet
+  std::vector<int> waiting;
+  std::vector<int> ready;
+  int finished_count = 0;
+
+  void RunSystem(int index) {
+    Span& span = timeline[index];
+    span.thread = std::this_thread::get_id();
+    span.start = Clock::now();
+    systems[index].run();
+    span.end = Clock::now();
+  }
+
+  // one thread of a parallel Run, takes the first ready system in the order
+  // they were added until every system is done
+  void RunReadySystems() {
+    while (true) {
+      int index = 0;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready_changed.wait(lock, [&] {
+          return !ready.empty() || finished_count == (int)systems.size();
+        });
+        if (ready.empty()) {
+          return;
+        }
+        const auto first = std::min_element(ready.begin(), ready.end());
+        index = *first;
+        ready.erase(first);
+      }
+      RunSystem(index);
+      int newly_ready = 0;
+      bool is_finished = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished_count++;
+        for (const int dependent : systems[index].dependents) {
+          if (--waiting[dependent] == 0) {
+            ready.emplace_back(dependent);
+            newly_ready++;
+          }
+        }
+        is_finished = finished_count == (int)systems.size();
+      }
+      // this thread takes one of the new systems itself, so a chain of
+      // systems runs on without waking anyone
+      if (is_finished) {
+        ready_changed.notify_all();
+      }
+      for (int i = 1; i < newly_ready; i++) {
+        ready_changed.notify_one();
+      }
+    }
+  }
+
+  // the largest set of systems none of which has to wait for another, by
+  // dilworth's theorem the system count less a maximum matching between
+  // every system and the systems that have to wait for it
+  int FindWidth() const {
+    const int count = (int)systems.size();
+    // after[i][j] when j has to wait for i, directly or not
+    std::vector<std::vector<bool>> after(count, std::vector<bool>(count));
+    for (int j = 0; j < count; j++) {
+      for (const int i : systems[j].dependencies) {
+        after[i][j] = true;
+        for (int k = 0; k < i; k++) {
+          if (after[k][i]) {
+            after[k][j] = true;
+          }
+        }
+      }
+    }
+    std::vector<int> matched(count, -1);
+    std::vector<bool> seen;
+    const std::function<bool(int)> augment = [&](int i) {
+      for (int j = 0; j < count; j++) {
+        if (after[i][j] && !seen[j]) {
+          seen[j] = true;
+          if (matched[j] < 0 || augment(matched[j])) {
+            matched[j] = i;
+            return true;
+          }
+        }
+      }
+      return false;
+    };
+    int matching = 0;
+    for (int i = 0; i < count; i++) {
+      seen.assign(count, false);
+      matching += augment(i);
+    }
+    return std::max(1, count - matching);
+  }
+
+ public:
+  // systems can only be added before Build
+  void Add(std::string name, Mask reads, Mask writes,
+           std::function<void()> run) {
+    systems.push_back(
+        {std::move(name), reads, writes, std::move(run), {}, {}});
+  }
+
+  void Build() {
+    for (auto& system : systems) {
+      system.dependencies.clear();
+      system.dependents.clear();
+    }
+    for (int j = 0; j < (int)systems.size(); j++) {
+      System& system = systems[j];
+      for (int i = 0; i < j; i++) {
+        System& earlier = systems[i];
+        if ((earlier.writes & (system.reads | system.writes)) ||
+            (earlier.reads & system.writes)) {
+          system.dependencies.emplace_back(i);
+          earlier.dependents.emplace_back(j);
+        }
+      }
+    }
+    width = FindWidth();
+    timeline.assign(systems.size(), {});
+  }
+
+  // every system on the calling thread, in the order they were added
+  void Run() {
+    frame_start = Clock::now();
+    for (int i = 0; i < (int)systems.size(); i++) {
+      RunSystem(i);
+    }
+  }
+
+  // on at most GetWidth threads of the pool, more would only ever sleep, and
+  // like Run() above when that leaves one thread. systems can not use this
+  // pool themselves. systems calling ParallelFor on one other pool take turns
+  // on it, so they never overlap however the schedule allows
+  void Run(WorkerPool& pool) {
+    const int thread_count = std::min(width, pool.GetThreadCount());
+    if (thread_count <= 1) {
+      Run();
+      return;
+    }
+    frame_start = Clock::now();
+    waiting.resize(systems.size());
+    ready.clear();
+    finished_count = 0;
+    for (int i = 0; i < (int)systems.size(); i++) {
+      waiting[i] = (int)systems[i].dependencies.size();
+      if (waiting[i] == 0) {
+        ready.emplace_back(i);
+      }
+    }
+    pool.ParallelFor(thread_count, [&](int) { RunReadySystems(); });
+  }
+
+  // a line per system of the last frame, with a bar over the part of the
+  // frame it ran in and the thread it ran on. bars above each other that
+  // overlap are systems that ran at the same time
+  void PrintTimeline() const {
+    constexpr int kWidth = 48;
+    Clock::time_point frame_end = frame_start;
+    for (const auto& span : timeline) {
+      frame_end = std::max(frame_end, span.end);
+    }
+    const double frame_time =
+        std::chrono::duration<double, std::milli>(frame_end - frame_start)
+            .count();
+    const auto column = [&](Clock::time_point time) {
+      const double ms =
+          std::chrono::duration<double, std::milli>(time - frame_start)
+              .count();
+      return frame_time > 0 ? (int)(ms / frame_time * kWidth) : 0;
+    };
+    std::vector<std::thread::id> threads;
+    for (const auto& span : timeline) {
+      if (std::find(threads.begin(), threads.end(), span.thread) ==
+          threads.end()) {
+        threads.emplace_back(span.thread);
+      }
+    }
+    printf("systems of the last frame, %.3f ms on %d threads\n", frame_time,
+           (int)threads.size());
+    for (int i = 0; i < (int)systems.size(); i++) {
+      const Span& span = timeline[i];
+      const int first = std::min(column(span.start), kWidth - 1);
+      const int last = std::max(first, std::min(column(span.end), kWidth - 1));
+      std::string bar(kWidth, '.');
+      std::fill(bar.begin() + first, bar.begin() + last + 1, '#');
+      const int thread =
+          (int)(std::find(threads.begin(), threads.end(), span.thread) -
+                threads.begin());
+      printf("  %-24s t%d |%s| %.3f ms\n", systems[i].name.c_str(), thread,
+             bar.c_str(),
+             std::chrono::duration<double, std::milli>(span.end - span.start)
+                 .count());
+    }
+  }
+
+  int GetSystemCount() const { return (int)systems.size(); }
+  // valid after Build
+  int GetWidth() const { return width; }
+  // threads worth giving a pool for Run, the width but no more than the cores
+  int GetThreadCount() const {
+    return std::max(
+        1, std::min(width, (int)std::thread::hardware_concurrency()));
+  }
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// fixed set of threads that work through the tasks of one ParallelFor call at
+// a time. the calling thread takes tasks too and the call only returns once
+// every task is done, so tasks can use anything on the caller's stack
+class WorkerPool {
+  std::vector<std::thread> threads;
+  // held for the whole of a ParallelFor call
+  std::mutex call_mutex;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  // the current call, a type erased pointer to its task and how to run it
+  void (*invoke)(void* task, int index) = nullptr;
+  void* task = nullptr;
+  int task_count = 0;
+  std::atomic<int> next_task{0};
+  // bumped by every call so sleeping threads know there is new work
+  unsigned int generation = 0;
+  int busy_threads = 0;
+  bool is_stopping = false;
+
+  void RunTasks() {
+    for (int index = next_task++; index < task_count; index = next_task++) {
+      invoke(task, index);
+    }
+  }
+
+  void WorkerLoop() {
+    unsigned int seen_generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] {
+          return is_stopping || generation != seen_generation;
+        });
+        if (is_stopping) {
+          return;
+        }
+        seen_generation = generation;
+      }
+      RunTasks();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy_threads == 0) {
+        done.notify_one();
+      }
+    }
+  }
+
+ public:
+  // thread_count includes the calling thread, by default one per core
+  explicit WorkerPool(
+      int thread_count = (int)std::thread::hardware_concurrency()) {
+    for (int i = 1; i < thread_count; i++) {
+      threads.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      is_stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // threads working on a ParallelFor call, the calling one included
+  int GetThreadCount() const { return (int)threads.size() + 1; }
+
+  // calls task(index) for every index below count, spread over the threads.
+  // which thread runs which index is not fixed, tasks that write to separate
+  // outputs per index give the same results on any number of threads
+  // calls from several threads at once take turns
+  template <typename Task>
+  void ParallelFor(int count, Task&& task_to_run) {
+    if (threads.empty() || count <= 1) {
+      for (int index = 0; index < count; index++) {
+        task_to_run(index);
+      }
+      return;
+    }
+    std::lock_guard<std::mutex> call_lock(call_mutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      invoke = [](void* task, int index) {
+        (*static_cast<std::remove_reference_t<Task>*>(task))(index);
+      };
+      task = (void*)&task_to_run;
+      task_count = count;
+      next_task = 0;
+      busy_threads = (int)threads.size();
+      generation++;
+    }
+    wake.notify_all();
+    RunTasks();
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return busy_threads == 0; });
+  }
+};
@@ -0,0 +1,248 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "constants.h"
+#include "entity.h"
+#include "spatial_hash_grid.h"
+
+namespace collision {
+// spatial hash over world space instead of the screen. cells are addressed by
+// integer cell coordinates of any range, packed into a 64-bit key and looked up
+// in an open addressing table per layer. nothing is clamped, so entities far
+// outside the view are spread over cells like everything else instead of
+// piling up in the border cells of SpatialGrid
+class WorldSpatialHash {
+  struct Slot {
+    uint64_t key = 0;
+    // index into cells, -1 for an empty slot
+    int cell = -1;
+  };
+
+  // cells are never removed from a table while it is in use, an emptied cell
+  // stays around for entities coming back and is dropped when the table grows
+  struct Table {
+    std::vector<Slot> slots;
+    std::vector<std::vector<entity::Entity>> cells;
+    std::vector<uint64_t> cell_keys;
+  };
+
+  float cell_width = grid_tile_width;
+  float cell_height = grid_tile_height;
+  Table tables[layer_count];
+  // cell range every entity currently occupies, indexed by entity id. only
+  // valid while is_inserted is set for that entity
+  CellRange entity_ranges[constants::kEntityCount]{};
+  bool is_inserted[constants::kEntityCount]{};
+  QueryStamps query_stamps{};
+
+  static uint64_t PackKey(int col, int row) {
+    return ((uint64_t)(uint32_t)col << 32) | (uint32_t)row;
+  }
+
+  // 64-bit finalizer from MurmurHash3, spreads neighbouring keys over the
+  // whole table
+  static uint64_t HashKey(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+  }
+
+  static int FindSlot(const Table& table, uint64_t key) {
+    const size_t mask = table.slots.size() - 1;
+    size_t slot = HashKey(key) & mask;
+    while (table.slots[slot].cell != -1 && table.slots[slot].key != key) {
+      slot = (slot + 1) & mask;
+    }
+    return (int)slot;
+  }
+
+  // returns the cell index for a key, or -1 if the cell was never created
+  static int FindCell(const Table& table, uint64_t key) {
+    if (table.slots.empty()) {
+      return -1;
+    }
+    return table.slots[FindSlot(table, key)].cell;
+  }
+
+  // drops empty cells and rebuilds the slots so the table is at most a
+  // quarter full
+  static void Grow(Table& table) {
+    size_t live_cells = 0;
+    for (size_t i = 0; i < table.cells.size(); i++) {
+      if (table.cells[i].empty()) {
+        continue;
+      }
+      if (live_cells != i) {
+        table.cells[live_cells] = std::move(table.cells[i]);
+        table.cell_keys[live_cells] = table.cell_keys[i];
+      }
+      live_cells++;
+    }
+    table.cells.resize(live_cells);
+    table.cell_keys.resize(live_cells);
+
+    size_t capacity = 64;
+    while (capacity < (live_cells + 1) * 4) {
+      capacity *= 2;
+    }
+    table.slots.assign(capacity, Slot{});
+    for (size_t i = 0; i < live_cells; i++) {
+      Slot& slot = table.slots[FindSlot(table, table.cell_keys[i])];
+      slot.key = table.cell_keys[i];
+      slot.cell = (int)i;
+    }
+  }
+
+  static std::vector<entity::Entity>& FindOrAddCell(Table& table,
+                                                    uint64_t key) {
+    // keep the load factor at or below one half
+    if ((table.cells.size() + 1) * 2 > table.slots.size()) {
+      Grow(table);
+    }
+    Slot& slot = table.slots[FindSlot(table, key)];
+    if (slot.cell == -1) {
+      slot.key = key;
+      slot.cell = (int)table.cells.size();
+      table.cells.emplace_back();
+      table.cell_keys.emplace_back(key);
+    }
+    return table.cells[slot.cell];
+  }
+
+  CellRange GetWorldCellRange(float x, float y, float x2, float y2) const {
+    return {(int)std::floor(x / cell_width), (int)std::floor(x2 / cell_width),
+            (int)std::floor(y / cell_height),
+            (int)std::floor(y2 / cell_height)};
+  }
+
+  void InsertIntoCell(const entity::Entity& entity, int col, int row) {
+    FindOrAddCell(tables[LayerOf(entity.type)], PackKey(col, row))
+        .emplace_back(entity);
+  }
+
+  void RemoveFromCell(const entity::Entity& entity, int col, int row) {
+    Table& table = tables[LayerOf(entity.type)];
+    const int cell_index = FindCell(table, PackKey(col, row));
+    if (cell_index == -1) {
+      return;
+    }
+    auto& cell = table.cells[cell_index];
+    auto it = std::find(cell.begin(), cell.end(), entity);
+    if (it == cell.end()) {
+      return;
+    }
+    *it = cell.back();
+    cell.pop_back();
+  }
+
+ public:
+  WorldSpatialHash() = default;
+  WorldSpatialHash(float cell_width, float cell_height)
+      : cell_width(cell_width), cell_height(cell_height) {}
+
+  // covers the same box around x, y as SpatialGrid::Update, only the cells the
+  // entity leaves and the cells it enters are touched
+  void Update(const entity::Entity& entity, float x, float y, float w,
+              float h) {
+    const CellRange range = GetWorldCellRange(x - w, y - h, x + w, y + h);
+    const int id = entity.id;
+    if (!is_inserted[id]) {
+      for (int row = range.min_row; row <= range.max_row; row++) {
+        for (int col = range.min_col; col <= range.max_col; col++) {
+          InsertIntoCell(entity, col, row);
+        }
+      }
+      entity_ranges[id] = range;
+      is_inserted[id] = true;
+      return;
+    }
+
+    const CellRange old_range = entity_ranges[id];
+    if (old_range == range) {
+      return;
+    }
+    for (int row = old_range.min_row; row <= old_range.max_row; row++) {
+      for (int col = old_range.min_col; col <= old_range.max_col; col++) {
+        if (!range.Contains(col, row)) {
+          RemoveFromCell(entity, col, row);
+        }
+      }
+    }
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        if (!old_range.Contains(col, row)) {
+          InsertIntoCell(entity, col, row);
+        }
+      }
+    }
+    entity_ranges[id] = range;
+  }
+
+  // does nothing if the entity is not inserted
+  void Remove(const entity::Entity& entity) {
+    const int id = entity.id;
+    if (!is_inserted[id]) {
+      return;
+    }
+    const CellRange& range = entity_ranges[id];
+    for (int row = range.min_row; row <= range.max_row; row++) {
+      for (int col = range.min_col; col <= range.max_col; col++) {
+        RemoveFromCell(entity, col, row);
+      }
+    }
+    is_inserted[id] = false;
+  }
+
+  bool Contains(const entity::Entity& entity) const {
+    return is_inserted[entity.id];
+  }
+
+  void Clear() {
+    for (auto& table : tables) {
+      table = Table{};
+    }
+    std::fill(std::begin(is_inserted), std::end(is_inserted), false);
+  }
+
+  // same contract as SpatialGrid::ForEachNearbyEntity
+  template <typename Visitor>
+  void ForEachNearbyEntity(LayerMask layers, float x, float y, float x2,
+                           float y2, Visitor&& visit) {
+    query_stamps.NextQuery();
+    const CellRange range = GetWorldCellRange(x, y, x2, y2);
+    for (int layer = 0; layer < layer_count; layer++) {
+      if ((layers & (1u << layer)) == 0) {
+        continue;
+      }
+      const Table& table = tables[layer];
+      for (int row = range.min_row; row <= range.max_row; row++) {
+        for (int col = range.min_col; col <= range.max_col; col++) {
+          const int cell_index = FindCell(table, PackKey(col, row));
+          if (cell_index == -1) {
+            continue;
+          }
+          for (const auto& entity : table.cells[cell_index]) {
+            if (query_stamps.Visit(entity)) {
+              visit(entity);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  template <typename Visitor>
+  void ForEachNearbyEntityOfType(entity::Type type, float x, float y,
+                                 float x2, float y2, Visitor&& visit) {
+    ForEachNearbyEntity(LayerBit(type), x, y, x2, y2,
+                        std::forward<Visitor>(visit));
+  }
+};
+}  // namespace collision
@@ -2,46 +2,109 @@
 // begins and ends there.
 //
 #include <algorithm>
+#include <bitset>
 #include <iostream>
 #include <numeric>
 #include <ranges>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "SDL/SDL_image.h"
+#include "aabb_tree.h"
 #include "common_math.h"
+#include "archetype_store.h"
 #include "components.h"
 #include "constants.h"
 #include "entity.h"
-#include "hasher.h"
+#include "entity_allocator.h"
+#include "entity_list.h"
+#include "grid_tuner.h"
+#include "group_bvh.h"
 #include "image_loader.h"
 #include "input.h"
+#include "morton_order.h"
+#include "narrowphase.h"
+#include "packed_grid.h"
 #include "spatial_hash_grid.h"
+#include "sweep_and_prune.h"
+#include "system_scheduler.h"
+#include "worker_pool.h"
+#include "world_spatial_hash.h"
 
 struct Application {
   SDL_Window* window = nullptr;
   SDL_Renderer* window_renderer = nullptr;
 };
 
-struct CollisionData {
-  int collider_id = 0;
+// which structure finds the enemies near a bullet
+enum class BroadphaseMode {
+  kIncremental,    // spatial_grid, entities are moved between cells
+  kRebuild,        // packed_grid, rebuilt from scratch every frame, with
+                   // batched narrowphase over its cells
+  kSweepAndPrune,  // sweep_and_prune, boxes kept sorted along x
+  kAabbTree,       // aabb_tree, balanced tree of fattened boxes
+  kWorldHash,      // world_spatial_hash, unbounded cells, off-screen included
+  kGroupBvh,       // group_bvh, one box per enemy formation refit every frame
+  kCount
 };
 
-class IDManager {
-  static int id;
-
- public:
-  static int GetNextID() { return id++; };
+struct CollisionData {
+  int collider_id = 0;
 };
 
-Position position_components[constants::kEntityCount]{};
-Velocity velocity_components[constants::kEntityCount]{};
-RenderData render_data_components[constants::kEntityCount]{};
-std::vector<entity::Entity> entities;
-std::vector<entity::Entity> active_entities;
-std::unordered_set<entity::Entity, Hasher> dead_entities;
+// components of every active entity. the player, enemies and bullets each
+// get their own archetype through their tag, enemies also have a Formation.
+// PreviousPosition is the position before the last AddVelocitiesToPositions,
+// bullets are swept from there to their current position when looking for hits
+using World = entity::ArchetypeStore<Position, PreviousPosition, Velocity,
+                                     RenderData, Formation, PlayerTag,
+                                     EnemyTag, BulletTag>;
+World world{};
+// ids are handed out to entities of any type, an id is reused once its entity
+// was destroyed
+entity::EntityAllocator entity_allocator{};
+entity::Handle player_handle = entity::kInvalidHandle;
+// kept per type too, updated on spawn and despawn
+entity::ActiveEntityLists active_entities;
+// entities that die this frame, removed by RemoveDeadEntities. the flag keeps
+// an entity that is hit twice from being queued twice
+std::bitset<constants::kEntityCount> dead_flags;
+std::vector<entity::Entity> dead_entities;
 collision::SpatialGrid spatial_grid{};
-int IDManager::id = 0;
+collision::PackedGrid packed_grid{};
+collision::BatchedNarrowphase batched_narrowphase{};
+collision::SweepAndPrune sweep_and_prune{};
+collision::AabbTree aabb_tree{};
+collision::WorldSpatialHash world_spatial_hash{};
+collision::GroupBvh group_bvh{};
+BroadphaseMode broadphase_mode = BroadphaseMode::kIncremental;
+// the rebuild mode builds its grid and searches it for hits on these threads,
+// the enemy systems spread their chunks over them too
+WorkerPool worker_pool{};
+bool parallel_collision = false;
+// resizes the cells of spatial_grid to fit the workload when enabled
+collision::GridTuner grid_tuner{};
+bool auto_tune_grid = false;
+// re-sorts the rows of the archetype store by grid cell every
+// morton_sort_interval frames when enabled
+entity::MortonOrder morton_order{};
+bool morton_sort_enabled = false;
+constexpr int morton_sort_interval = 60;
+// the systems of a frame with what they read and write. they run one after
+// another, or side by side on the system pool of main when parallel_systems
+// is set. that pool is kept apart from worker_pool, which the systems use
+// under parallel_collision; systems using it take turns on it, so e.g.
+// AngleTowardsVelocity and HandleCollisions do not overlap then
+SystemScheduler scheduler{};
+bool parallel_systems = false;
+// state the systems share besides the components, one bit each after the
+// component bits. kEntitySet is which entities exist and where their rows
+// are, written by spawning and despawning and read by every view
+constexpr SystemScheduler::Mask kEntitySet = SystemScheduler::Mask{1}
+                                             << World::kComponentCount;
+constexpr SystemScheduler::Mask kBroadphases = kEntitySet << 1;
+constexpr SystemScheduler::Mask kDeadEntities = kEntitySet << 2;
 
 bool DEBUG_ENABLED = false;
 
@@ -50,45 +113,61 @@ inline bool IsOutsideView(float x, float y, float w, float h) {
          y > constants::kGameHeight;
 }
 
-std::vector<int> GetActiveEntitiesIndices(entity::Type type) {
-  std::vector<int> matching_entity_indices;
-  for (int i = 0; i < active_entities.size(); i++) {
-    if (active_entities[i].type == type) {
-      matching_entity_indices.emplace_back(i);
-    }
+// view filter keeping the rows inside the view, the position has to be the
+// first component of the view
+constexpr auto kInView = [](const Position& pos, const auto&...) {
+  return !IsOutsideView(pos.x, pos.y, 16.f, 16.f);
+};
+constexpr auto kOutsideView = [](const Position& pos, const auto&...) {
+  return IsOutsideView(pos.x, pos.y, 16.f, 16.f);
+};
+
+inline int GetEnemyGroup(const entity::Entity& enemy) {
+  return world.Get<Formation>(enemy.id).group;
+}
+
+inline void FlagDead(const entity::Entity& entity) {
+  if (!dead_flags.test(entity.id)) {
+    dead_flags.set(entity.id);
+    dead_entities.emplace_back(entity);
   }
-  return matching_entity_indices;
 }
 
-std::vector<entity::Entity> GetActiveEntities(entity::Type type) {
-  std::vector<entity::Entity> matching_entities;
-  for (int i = 0; i < active_entities.size(); i++) {
-    if (active_entities[i].type == type) {
-      matching_entities.emplace_back(active_entities[i]);
-    }
+// creates an entity with the components every entity has and the extra ones
+// of its type, returns false when every id is in use
+template <typename... Extra>
+bool SpawnEntity(entity::Type type, const Position& position,
+                 const Velocity& velocity, const RenderData& render_data,
+                 entity::Entity& entity, const Extra&... extra) {
+  if (!entity_allocator.Create(type, entity)) {
+    return false;
   }
-  return matching_entities;
+  world.Add(entity.id, position, PreviousPosition{position.x, position.y},
+            velocity, render_data, extra...);
+  active_entities.Add(entity);
+  return true;
 }
 
-std::vector<entity::Entity> GetActiveEntitiesInsideView(entity::Type type) {
-  std::vector<entity::Entity> matching_entities;
-  for (const auto& entity : active_entities) {
-    auto pos = position_components[entity.id];
-    if (entity.type == type && !IsOutsideView(pos.x, pos.y, 16.f, 16.f)) {
-      matching_entities.emplace_back(entity);
-    }
+// returns false if the entity was not active
+bool DestroyEntity(const entity::Entity& entity) {
+  if (!active_entities.Remove(entity)) {
+    return false;
   }
-  return matching_entities;
+  world.Remove(entity.id);
+  entity_allocator.Destroy(entity);
+  return true;
 }
 
+// only walks the dead entities and takes each out with a swap and pop, so a
+// frame killing a thousand enemies costs no more per death than killing one
 void RemoveDeadEntities() {
-  for (int i = static_cast<int>(active_entities.size() - 1); i >= 0; i--) {
-    if (dead_entities.contains(active_entities[i])) {
-      auto& entity = active_entities[i];
-      auto pos = position_components[entity.id];
-      active_entities.erase(active_entities.begin() + i);
-      spatial_grid.Remove(entity, pos.x, pos.y, 16.f, 16.f);
-    }
+  for (const auto& entity : dead_entities) {
+    dead_flags.reset(entity.id);
+    spatial_grid.Remove(entity);
+    sweep_and_prune.Remove(entity);
+    aabb_tree.Remove(entity);
+    world_spatial_hash.Remove(entity);
+    DestroyEntity(entity);
   }
   dead_entities.clear();
 }
@@ -127,62 +206,87 @@ bool InitializeApplication(Application& app) {
 }
 
 void RenderCollisionGrid(SDL_Renderer* renderer) {
+  if (broadphase_mode == BroadphaseMode::kGroupBvh) {
+    SDL_SetRenderDrawColor(renderer, 0x55, 0x55, 0x00, 0xFF);
+    for (int group = 0; group < group_bvh.GetGroupCount(); group++) {
+      const auto& bounds = group_bvh.GetGroupBounds(group);
+      SDL_FRect outline_rect = {bounds.min_x, bounds.min_y,
+                                bounds.max_x - bounds.min_x,
+                                bounds.max_y - bounds.min_y};
+      SDL_RenderDrawRectF(renderer, &outline_rect);
+    }
+    return;
+  }
   SDL_SetRenderDrawColor(renderer, 0x00, 0x55, 0x55, 0xFF);
-  for (int i = 0; i < collision::grid_rows; i++) {
-    for (int j = 0; j < collision::grid_cols; j++) {
-      SDL_FRect outlineRect = {
-          j * collision::grid_tile_width, i * collision::grid_tile_height,
-          collision::grid_tile_width, collision::grid_tile_height};
+  // only the incremental grid can be resized
+  const collision::GridDimensions dimensions =
+      broadphase_mode == BroadphaseMode::kIncremental
+          ? spatial_grid.GetDimensions()
+          : collision::GridDimensions{};
+  const float tile_width = dimensions.GetTileWidth();
+  const float tile_height = dimensions.GetTileHeight();
+  for (int i = 0; i < dimensions.rows; i++) {
+    for (int j = 0; j < dimensions.cols; j++) {
+      SDL_FRect outlineRect = {j * tile_width, i * tile_height, tile_width,
+                               tile_height};
       SDL_RenderDrawRectF(renderer, &outlineRect);
     }
   }
 }
 
 // movement system
-void AddVelocitiesToPositions(
-    const float delta_time,
-    std::unordered_map<int, Position>& previous_positions) {
+void AddVelocitiesToPositions(const float delta_time) {
   float dt = delta_time;
   if (dt > 0.16f) {
     dt = 0.16f;
   }
-  for (int i = 0; i < active_entities.size(); i++) {
-    auto id = active_entities[i].id;
-    auto pos = position_components[id];
-    previous_positions[id].x = pos.x;
-    previous_positions[id].y = pos.y;
-    position_components[id].x += velocity_components[id].x * dt;
-    position_components[id].y += velocity_components[id].y * dt;
-  }
+  // streams through the columns of every chunk
+  world.View<Position, PreviousPosition, const Velocity>().ForEach(
+      [dt](Position& pos, PreviousPosition& previous,
+           const Velocity& velocity) {
+        previous = {pos.x, pos.y};
+        pos.x += velocity.x * dt;
+        pos.y += velocity.y * dt;
+      });
 }
 
-// enemy rotation system
-void AngleTowardsVelocity(const std::vector<entity::Entity>& enemies) {
-  for (const auto& enemy : enemies) {
-    auto id = enemy.id;
-    const auto& velocity = velocity_components[id];
+// enemy rotation system, enemies outside the view are not drawn and skipped
+void AngleTowardsVelocity() {
+  const auto enemies = world.View<const Position, const Velocity, RenderData>()
+                           .With<EnemyTag>()
+                           .Where(kInView);
+  const auto turn = [](const Position&, const Velocity& velocity,
+                       RenderData& render_data) {
     float angle = math::RadToDeg(atan2f(velocity.y, velocity.x));
-    render_data_components[id].angle = (double)(angle + 90.f);
+    render_data.angle = (double)(angle + 90.f);
+  };
+  if (parallel_collision) {
+    enemies.ParallelForEach(worker_pool, turn);
+  } else {
+    enemies.ForEach(turn);
   }
 }
 
 // updates enemy velocity so it will move towards target position
-void UpdateEnemyVelocities(const std::vector<entity::Entity>& enemies,
-                           const Position* target_pos) {
-  for (const auto& enemy : enemies) {
-    auto id = enemy.id;
-    float x = target_pos->x - position_components[id].x;
-    float y = target_pos->y - position_components[id].y;
+void UpdateEnemyVelocities(const Position target_pos) {
+  const auto enemies =
+      world.View<const Position, Velocity>().With<EnemyTag>();
+  const auto steer = [target_pos](const Position& pos, Velocity& velocity) {
+    float x = target_pos.x - pos.x;
+    float y = target_pos.y - pos.y;
     float length = math::GetMagnitude(x, y);
     if (length < 6.f) {
-      velocity_components[id].x = 0;
-      velocity_components[id].y = 0;
-      continue;
+      velocity = {0, 0};
+      return;
     }
     x /= length;
     y /= length;
-    velocity_components[id].x = x * 100.f;
-    velocity_components[id].y = y * 100.f;
+    velocity = {x * 100.f, y * 100.f};
+  };
+  if (parallel_collision) {
+    enemies.ParallelForEach(worker_pool, steer);
+  } else {
+    enemies.ForEach(steer);
   }
 }
 
@@ -193,23 +297,42 @@ inline float GetUpdatedTimeDelta(Uint64& prev_time) {
   return delta;
 }
 
-void RenderGame(const Application& app, const RenderData render_data_comps[],
-                SDL_Texture* background_texture, SDL_Texture* render_texture) {
+void RenderGame(const Application& app, SDL_Texture* background_texture,
+                SDL_Texture* render_texture) {
   SDL_SetRenderTarget(app.window_renderer, render_texture);
   SDL_RenderClear(app.window_renderer);
 
   // Render texture to screen
   SDL_RenderCopy(app.window_renderer, background_texture, NULL, NULL);
-  SDL_FRect frect{};
-  for (const auto& entity : active_entities) {
-    auto id = entity.id;
-    frect.x = render_data_comps[id].position->x;
-    frect.y = render_data_comps[id].position->y;
-    frect.w = render_data_comps[id].size[0];
-    frect.h = render_data_comps[id].size[1];
-    SDL_RenderCopyExF(app.window_renderer, render_data_comps[id].texture, NULL,
-                      &frect, render_data_comps[id].angle, NULL,
+  // the group boxes skip whole formations outside the view
+  static std::vector<bool> visible_groups;
+  const bool cull_groups = broadphase_mode == BroadphaseMode::kGroupBvh;
+  if (cull_groups) {
+    visible_groups.assign(group_bvh.GetGroupCount(), false);
+    group_bvh.ForEachGroupOverlapping(
+        0.f, 0.f, (float)constants::kGameWidth, (float)constants::kGameHeight,
+        [&](int group) { visible_groups[group] = true; });
+  }
+  const auto draw = [&](const Position& pos, const RenderData& render_data) {
+    const SDL_FRect frect{pos.x, pos.y, render_data.size[0],
+                          render_data.size[1]};
+    SDL_RenderCopyExF(app.window_renderer, render_data.texture, NULL, &frect,
+                      render_data.angle, NULL,
                       SDL_RendererFlip::SDL_FLIP_NONE);
+  };
+  for (auto [pos, render_data] : world.View<const Position, const RenderData>()
+                                     .Without<Formation>()) {
+    draw(pos, render_data);
+  }
+  const auto is_visible = [&](const Position&, const RenderData&,
+                              const Formation& formation) {
+    return !cull_groups || (formation.group < (int)visible_groups.size() &&
+                            visible_groups[formation.group]);
+  };
+  for (auto [pos, render_data, formation] :
+       world.View<const Position, const RenderData, const Formation>().Where(
+           is_visible)) {
+    draw(pos, render_data);
   }
   if (DEBUG_ENABLED) {
     RenderCollisionGrid(app.window_renderer);
@@ -235,133 +358,356 @@ void PrintFPS(Uint64 time_start_of_frame) {
   }
 }
 
-void UpdateCollisionGrid(
-    const std::vector<entity::Entity>& enemies,
-    std::unordered_map<int, Position>& previous_positions) {
-  for (const auto& entity : enemies) {
-    auto id = entity.id;
-    auto pos = position_components[id];
-    auto prev_pos = previous_positions[id];
-    // if (IsOutsideView(position_components[id].x, position_components[id].y,
-    //                   16.f, 16.f)) {
-    //   continue;
-    // }
-    //  only update grid if enity has moved over a certain distance
-    if (math::GetDistance(pos.x, pos.y, prev_pos.x, prev_pos.y) > 8.f) {
-      spatial_grid.Update(entity, position_components[id].x,
-                          position_components[id].y, 16, 16);
-    }
+// only enemies inside the view are kept in the broadphase
+template <typename Broadphase>
+void UpdateBroadphase(Broadphase& broadphase) {
+  world.View<const Position>().With<EnemyTag>().ForEach(
+      [&](int id, const Position& pos) {
+        const entity::Entity enemy{id, entity::Type::kEnemy};
+        if (IsOutsideView(pos.x, pos.y, 16.f, 16.f)) {
+          broadphase.Remove(enemy);
+          return;
+        }
+        broadphase.Update(enemy, pos.x, pos.y, 16.f, 16.f);
+      });
+}
+
+// the incremental structures skip enemies whose cells, position in the sorted
+// order or fattened box did not change since the last update
+void UpdateCollisionGrid() {
+  static std::vector<entity::Entity> packed_entities;
+  switch (broadphase_mode) {
+    case BroadphaseMode::kRebuild:
+      // bullets go into the packed grid too, the narrowphase pairs them with
+      // the enemies sharing their cells
+      packed_entities.clear();
+      world.View<const Position>().With<EnemyTag>().Where(kInView).ForEach(
+          [](int id, const Position&) {
+            packed_entities.push_back({id, entity::Type::kEnemy});
+          });
+      for (const auto& entity :
+           active_entities.GetOfType(entity::Type::kBullet)) {
+        packed_entities.emplace_back(entity);
+      }
+      if (parallel_collision) {
+        packed_grid.Rebuild(packed_entities, world.GetLookup<Position>(),
+                            world.GetLookup<PreviousPosition>(), 16.f, 16.f,
+                            worker_pool);
+      } else {
+        packed_grid.Rebuild(packed_entities, world.GetLookup<Position>(),
+                            world.GetLookup<PreviousPosition>(), 16.f, 16.f);
+      }
+      break;
+    case BroadphaseMode::kSweepAndPrune:
+      UpdateBroadphase(sweep_and_prune);
+      break;
+    case BroadphaseMode::kAabbTree:
+      UpdateBroadphase(aabb_tree);
+      break;
+    case BroadphaseMode::kWorldHash:
+      // no clamping to the view, so enemies outside it can stay in the hash
+      world.View<const Position>().With<EnemyTag>().ForEach(
+          [](int id, const Position& pos) {
+            world_spatial_hash.Update({id, entity::Type::kEnemy}, pos.x, pos.y,
+                                      16.f, 16.f);
+          });
+      break;
+    case BroadphaseMode::kGroupBvh:
+      // refit from scratch, the group boxes cover enemies outside the view too
+      group_bvh.Refit(
+          active_entities.GetOfType(entity::Type::kEnemy).GetEntities(),
+          world.GetLookup<Position>(), 16.f, 16.f, GetEnemyGroup);
+      break;
+    default:
+      UpdateBroadphase(spatial_grid);
+      break;
   }
 }
 
+// visits the enemies the current broadphase finds near the box
+template <typename Visitor>
+void ForEachNearbyEnemy(float x, float y, float x2, float y2,
+                        Visitor&& visit) {
+  switch (broadphase_mode) {
+    case BroadphaseMode::kRebuild:
+      packed_grid.ForEachNearbyEntityOfType(entity::Type::kEnemy, x, y, x2, y2,
+                                            visit);
+      break;
+    case BroadphaseMode::kSweepAndPrune:
+      sweep_and_prune.ForEachNearbyEntityOfType(entity::Type::kEnemy, x, y, x2,
+                                                y2, visit);
+      break;
+    case BroadphaseMode::kAabbTree:
+      aabb_tree.ForEachNearbyEntityOfType(entity::Type::kEnemy, x, y, x2, y2,
+                                          visit);
+      break;
+    case BroadphaseMode::kWorldHash:
+      world_spatial_hash.ForEachNearbyEntityOfType(entity::Type::kEnemy, x, y,
+                                                   x2, y2, visit);
+      break;
+    case BroadphaseMode::kGroupBvh:
+      group_bvh.ForEachNearbyEntityOfType(entity::Type::kEnemy, x, y, x2, y2,
+                                          visit);
+      break;
+    default:
+      spatial_grid.ForEachNearbyEntityOfType(entity::Type::kEnemy, x, y, x2,
+                                             y2, visit);
+      break;
+  }
+}
+
+// bullets are swept from their previous to their current position, so fast
+// bullets or long frames can not carry them through an enemy
 void HandleCollisions() {
-  SDL_FRect bullet_rect{};
-  SDL_FRect enemy_rect{};
-  CollisionData collision_data;
-
-  const auto bullets = GetActiveEntities(entity::Type::kBullet);
-  for (const auto& bullet : bullets) {
-    auto bullet_id = bullet.id;
-    bullet_rect.x = position_components[bullet_id].x;
-    bullet_rect.y = position_components[bullet_id].y;
-    bullet_rect.w = 16.f;
-    bullet_rect.h = 16.f;
-
-    const auto nearby_enemies = spatial_grid.FindNearbyEntitiesOfType(
-        entity::Type::kEnemy, bullet_rect.x, bullet_rect.y,
-        bullet_rect.x + bullet_rect.w, bullet_rect.y + bullet_rect.h);
-
-    for (const auto& enemy : nearby_enemies) {
-      auto id = enemy.id;
-      enemy_rect.x = position_components[id].x;
-      enemy_rect.y = position_components[id].y;
-      enemy_rect.w = 16.f;
-      enemy_rect.h = 16.f;
-      if (SDL_HasIntersectionF(&bullet_rect, &enemy_rect)) {
-        dead_entities.insert(enemy);
+  if (broadphase_mode == BroadphaseMode::kRebuild) {
+    const auto& hits =
+        parallel_collision
+            ? batched_narrowphase.FindHits(
+                  packed_grid, entity::Type::kBullet, entity::Type::kEnemy,
+                  16.f, 16.f, world.GetLookup<PreviousPosition>(), worker_pool)
+            : batched_narrowphase.FindHits(
+                  packed_grid, entity::Type::kBullet, entity::Type::kEnemy,
+                  16.f, 16.f, world.GetLookup<PreviousPosition>());
+    if (DEBUG_ENABLED && parallel_collision) {
+      static collision::BatchedNarrowphase single_threaded{};
+      const auto& expected = single_threaded.FindHits(
+          packed_grid, entity::Type::kBullet, entity::Type::kEnemy, 16.f,
+          16.f, world.GetLookup<PreviousPosition>());
+      if (!std::equal(hits.begin(), hits.end(), expected.begin(),
+                      expected.end(),
+                      [](const collision::HitPair& a,
+                         const collision::HitPair& b) {
+                        return a.a == b.a && a.b == b.b;
+                      })) {
+        printf("threaded hits do not match the single threaded ones!\n");
+      }
+    }
+    for (const auto& hit : hits) {
+      FlagDead(hit.b);
+    }
+    return;
+  }
+
+  int hit_count = 0;
+  const auto bullets =
+      world.View<const Position, const PreviousPosition>().With<BulletTag>();
+  bullets.ForEach([&](const Position& pos, const PreviousPosition& previous) {
+    const float dx = pos.x - previous.x;
+    const float dy = pos.y - previous.y;
+    const auto test_enemy = [&](const entity::Entity& enemy) {
+      const auto& enemy_pos = world.Get<Position>(enemy.id);
+      if (collision::SweptOverlaps(previous.x, previous.y, dx, dy, 16.f, 16.f,
+                                   enemy_pos.x, enemy_pos.y, 16.f, 16.f)) {
+        FlagDead(enemy);
+        hit_count++;
       }
+    };
+
+    const float min_x = std::min(pos.x, previous.x);
+    const float min_y = std::min(pos.y, previous.y);
+    const float max_x = std::max(pos.x, previous.x) + 16.f;
+    const float max_y = std::max(pos.y, previous.y) + 16.f;
+    ForEachNearbyEnemy(min_x, min_y, max_x, max_y, test_enemy);
+  });
+  if (broadphase_mode == BroadphaseMode::kIncremental) {
+    spatial_grid.RecordHits(hit_count);
+  }
+}
+
+// resizes the grid when tuning
+void ReportCollisionStats() {
+  if (auto_tune_grid && broadphase_mode == BroadphaseMode::kIncremental) {
+    const collision::GridStats stats = spatial_grid.GetStats();
+    if (grid_tuner.Update(spatial_grid)) {
+      printf(
+          "grid resized to %dx%d, %.1f per cell (max %d), %.1f candidates "
+          "per query, %.0f%% hits\n",
+          spatial_grid.GetDimensions().cols,
+          spatial_grid.GetDimensions().rows, stats.mean_per_cell,
+          stats.max_per_cell, stats.candidates_per_query,
+          stats.hit_fraction * 100.f);
     }
   }
 }
 
-void HandlePlayerLogic(float delta_time) {
-  static int current_bullet_index = constants::kLastEnemyIndex + 1;
+// the grid only holds the enemies inside the view
+bool IsCollisionGridConsistent() {
+  static std::vector<entity::Entity> enemies_inside_view;
+  enemies_inside_view.clear();
+  world.View<const Position>().With<EnemyTag>().Where(kInView).ForEach(
+      [](int id, const Position&) {
+        enemies_inside_view.push_back({id, entity::Type::kEnemy});
+      });
+  return spatial_grid.IsConsistent(enemies_inside_view,
+                                   world.GetLookup<Position>(), 16.f, 16.f);
+}
+
+// empties every broadphase and fills the current one from scratch
+void RefillBroadphase() {
+  spatial_grid.Clear();
+  packed_grid.Clear();
+  sweep_and_prune.Clear();
+  aabb_tree.Clear();
+  world_spatial_hash.Clear();
+  group_bvh.Clear();
+  UpdateCollisionGrid();
+}
+
+void CycleBroadphaseMode() {
+  broadphase_mode = (BroadphaseMode)(((int)broadphase_mode + 1) %
+                                     (int)BroadphaseMode::kCount);
+  // the new broadphase was not kept up to date
+  RefillBroadphase();
+  switch (broadphase_mode) {
+    case BroadphaseMode::kRebuild:
+      printf("broadphase: rebuild every frame\n");
+      break;
+    case BroadphaseMode::kSweepAndPrune:
+      printf("broadphase: sweep and prune\n");
+      break;
+    case BroadphaseMode::kAabbTree:
+      printf("broadphase: aabb tree\n");
+      break;
+    case BroadphaseMode::kWorldHash:
+      printf("broadphase: world space hash\n");
+      break;
+    case BroadphaseMode::kGroupBvh:
+      printf("broadphase: enemy group boxes\n");
+      break;
+    default:
+      printf("broadphase: incremental\n");
+      break;
+  }
+}
+
+// lays the rows of every archetype out so entities in nearby cells sit next
+// to each other, the loops over enemies and the cells of the broadphase then
+// walk memory in order instead of jumping around it
+void SortEntitiesInMortonOrder() {
+  world.Reorder(morton_order.Sort(active_entities.GetAll().GetEntities(),
+                                  world.GetLookup<Position>()));
+  // the entity lists follow, so systems looking components up by id walk the
+  // chunks front to back too
+  active_entities.Sort([](const entity::Entity& a, const entity::Entity& b) {
+    const World::Location& la = world.GetLocation(a.id);
+    const World::Location& lb = world.GetLocation(b.id);
+    return std::tie(la.archetype, la.chunk, la.row) <
+           std::tie(lb.archetype, lb.chunk, lb.row);
+  });
+}
+
+void HandlePlayerLogic(float delta_time, const entity::Entity& player,
+                       SDL_Texture* bullet_texture) {
+  Velocity& velocity = world.Get<Velocity>(player.id);
+  RenderData& render_data = world.Get<RenderData>(player.id);
   static float shoot_cooldown = 0.1f;
   static float shoot_timer = 0.f;
   shoot_timer -= delta_time;
   float horizontal = input::Handler::GetAxis(input::Axis::kHorizontal);
   if (horizontal != 0) {
     float angle_delta = (float)(delta_time * 60.f * horizontal);
-    render_data_components[0].angle += angle_delta;
+    render_data.angle += angle_delta;
   }
 
   float vertical = input::Handler::GetAxis(input::Axis::kVertical);
-  float radians = math::RadToDeg((float)render_data_components[0].angle);
+  float radians = math::RadToDeg((float)render_data.angle);
   float facing_x = (float)std::cos(radians);
   float facing_y = (float)std::sin(radians);
   if (vertical != 0) {
     float new_x = (float)(60 * delta_time * facing_x * vertical);
     float new_y = (float)(60 * delta_time * facing_y * vertical);
-    velocity_components[0].x += new_x;
-    velocity_components[0].y += new_y;
+    velocity.x += new_x;
+    velocity.y += new_y;
   } else {
-    auto velocity_x = velocity_components[0].x;
-    auto velocity_y = velocity_components[0].y;
+    auto velocity_x = velocity.x;
+    auto velocity_y = velocity.y;
     float new_x = (float)(30 * delta_time * math::Sign(velocity_x) * -1);
     float new_y = (float)(30 * delta_time * math::Sign(velocity_y) * -1);
-    velocity_components[0].x += new_x;
-    velocity_components[0].y += new_y;
+    velocity.x += new_x;
+    velocity.y += new_y;
   }
   if (input::Handler::IsKeyDown(SDL_SCANCODE_SPACE) && shoot_timer <= 0) {
-    active_entities.emplace_back(entities[current_bullet_index]);
-    position_components[current_bullet_index].x = position_components[0].x;
-    position_components[current_bullet_index].y = position_components[0].y;
-    velocity_components[current_bullet_index] = {facing_x * 200.f,
-                                                 facing_y * 200.f};
-
-    render_data_components[current_bullet_index].angle =
-        (float)render_data_components[0].angle;
-    if (++current_bullet_index >= constants::kEntityCount) {
-      current_bullet_index = constants::kLastEnemyIndex + 1;
-    }
+    // no shot while every id is taken
+    entity::Entity bullet{};
+    SpawnEntity(entity::Type::kBullet, world.Get<Position>(player.id),
+                {facing_x * 200.f, facing_y * 200.f},
+                {bullet_texture, {16.f, 16.f}, render_data.angle}, bullet,
+                BulletTag{});
     shoot_timer = shoot_cooldown;
   }
 }
 
+// lays out the enemies in formations of constants::kEnemyGroupSize
 void InitializeEnemies(SDL_Texture* texture1, SDL_Texture* texture2) {
-  for (int i = 1; i <= constants::kLastEnemyIndex; i++) {
+  for (int i = 1; i <= constants::kEnemyShipCount; i++) {
     int group = (i - 1) / constants::kEnemyGroupSize;
     int group_x = group % 5;
     int group_y = group / 5;
     int x = i % 10;
     int y = i / 10;
-    position_components[i] = {group_x * 75.f + x * 20.f,
-                              group_y * 75.f + y * 20.f};
-    render_data_components[i] = {&position_components[i],
-                                 i % 2 == 0 ? texture1 : texture2,
-                                 {16.f, 16.f},
-                                 0};
+    entity::Entity enemy{};
+    if (!SpawnEntity(entity::Type::kEnemy,
+                     {group_x * 75.f + x * 20.f, group_y * 75.f + y * 20.f},
+                     {}, {i % 2 == 0 ? texture1 : texture2, {16.f, 16.f}, 0},
+                     enemy, Formation{group}, EnemyTag{})) {
+      break;
+    }
   }
 }
 
-void InitializeBullets(SDL_Texture* texture) {
-  int start = constants::kLastEnemyIndex + 1;
-  for (int i = start; i < constants::kEntityCount; i++) {
-    render_data_components[i] = {
-        &position_components[i], texture, {16.f, 16.f}, 0};
-  }
+void FlagStrayBullets() {
+  world.View<const Position>().With<BulletTag>().Where(kOutsideView).ForEach(
+      [](int id, const Position&) {
+        FlagDead({id, entity::Type::kBullet});
+      });
 }
 
-void FlagStrayBullets() {
-  const auto& bullets = GetActiveEntities(entity::Type::kBullet);
-  for (const auto& bullet : bullets) {
-    auto id = bullet.id;
-    auto pos = position_components[id];
-    if (!IsOutsideView(pos.x, pos.y, 16.f, 16.f)) {
-      continue;
-    }
-    dead_entities.insert(bullet);
-  }
+// pushes the systems of a frame in the order they ran in before there was a
+// scheduler, apart from AngleTowardsVelocity. that one reads the positions
+// after movement now, so it can run alongside the collision systems
+void ScheduleSystems(const entity::Entity& player, const float& delta_time,
+                     SDL_Texture* bullet_texture) {
+  scheduler.Add("HandlePlayerLogic", World::MaskOf<Position>(),
+                World::MaskOf<Velocity, RenderData>() | kEntitySet,
+                [&player, &delta_time, bullet_texture] {
+                  HandlePlayerLogic(delta_time, player, bullet_texture);
+                });
+  scheduler.Add("UpdateEnemyVelocities",
+                World::MaskOf<Position>() | kEntitySet,
+                World::MaskOf<Velocity>(), [&player] {
+                  UpdateEnemyVelocities(world.Get<Position>(player.id));
+                });
+  scheduler.Add("AddVelocitiesToPositions",
+                World::MaskOf<Velocity>() | kEntitySet,
+                World::MaskOf<Position, PreviousPosition>(),
+                [&delta_time] { AddVelocitiesToPositions(delta_time); });
+  scheduler.Add("AngleTowardsVelocity",
+                World::MaskOf<Position, Velocity>() | kEntitySet,
+                World::MaskOf<RenderData>(), [] { AngleTowardsVelocity(); });
+  scheduler.Add(
+      "UpdateCollisionGrid",
+      World::MaskOf<Position, PreviousPosition, Formation>() | kEntitySet,
+      kBroadphases, [] {
+        UpdateCollisionGrid();
+        if (DEBUG_ENABLED && broadphase_mode == BroadphaseMode::kIncremental &&
+            !IsCollisionGridConsistent()) {
+          printf("collision grid does not match its contents!\n");
+        }
+      });
+  scheduler.Add("HandleCollisions",
+                World::MaskOf<Position, PreviousPosition>() | kEntitySet,
+                kBroadphases | kDeadEntities, [] { HandleCollisions(); });
+  scheduler.Add("ReportCollisionStats", 0, kBroadphases,
+                [] { ReportCollisionStats(); });
+  scheduler.Add("FlagStrayBullets", World::MaskOf<Position>() | kEntitySet,
+                kDeadEntities, [] { FlagStrayBullets(); });
+  // removing rows moves every component of the last row of an archetype
+  scheduler.Add("RemoveDeadEntities", 0,
+                kEntitySet | kBroadphases | kDeadEntities |
+                    World::MaskOf<Position, PreviousPosition, Velocity,
+                                  RenderData, Formation>(),
+                [] { RemoveDeadEntities(); });
+  scheduler.Build();
 }
 
 int main(int, char*[]) {
@@ -389,39 +735,22 @@ int main(int, char*[]) {
       image_loader.GetImage("./assets/enemy2.png", app.window_renderer);
   SDL_Texture* bullet_texture =
       image_loader.GetImage("./assets/bullet.png", app.window_renderer);
-  position_components[0].x = 100.f;
-  position_components[0].y = 100.f;
-  render_data_components[0].texture = player_texture;
-  render_data_components[0].position = &position_components[0];
-  render_data_components[0].size[0] = 16.f;
-  render_data_components[0].size[1] = 16.f;
-
-  entities.reserve(constants::kEntityCount);
-  active_entities.reserve(constants::kEntityCount);
-  entities.emplace_back(
-      entity::Entity{IDManager::GetNextID(), entity::Type::kPlayer});
-  for (int i = 0; i < constants::kEnemyShipCount; i++) {
-    entities.emplace_back(
-        entity::Entity{IDManager::GetNextID(), entity::Type::kEnemy});
-  }
-  for (int i = 0; i < constants::kBulletCount; i++) {
-    entities.emplace_back(
-        entity::Entity{IDManager::GetNextID(), entity::Type::kBullet});
-  }
-  for (int i = 0; i < constants::kEnemyShipCount + 1; i++) {
-    active_entities.push_back(entities[i]);
-  }
+  entity::Entity player{};
+  SpawnEntity(entity::Type::kPlayer, {100.f, 100.f}, {},
+              {player_texture, {16.f, 16.f}, 0}, player, PlayerTag{});
+  player_handle = entity_allocator.GetHandle(player);
 
   InitializeEnemies(enemy_texture, enemy_texture2);
-  InitializeBullets(bullet_texture);
 
   Uint64 previous_time = SDL_GetPerformanceCounter();
+  float delta_time = 0.f;
+  ScheduleSystems(player, delta_time, bullet_texture);
+  // no more threads than systems that can run at the same time, or cores
+  WorkerPool system_pool(scheduler.GetThreadCount());
 
   bool is_running = true;
 
   while (is_running) {
-    std::unordered_map<int, Position> previous_active_positions(
-        active_entities.size());
     input::Handler::Update();
 
     if (input::Handler::IsKeyDown(SDL_SCANCODE_ESCAPE)) {
@@ -431,25 +760,52 @@ int main(int, char*[]) {
     if (input::Handler::GetKeyPressed(SDL_SCANCODE_F1)) {
       DEBUG_ENABLED = !DEBUG_ENABLED;
     }
+    if (input::Handler::GetKeyPressed(SDL_SCANCODE_F2)) {
+      CycleBroadphaseMode();
+    }
+    if (input::Handler::GetKeyPressed(SDL_SCANCODE_F3)) {
+      parallel_collision = !parallel_collision;
+      printf("collision threads: %d\n",
+             parallel_collision ? worker_pool.GetThreadCount() : 1);
+    }
+    if (input::Handler::GetKeyPressed(SDL_SCANCODE_F4)) {
+      auto_tune_grid = !auto_tune_grid;
+      spatial_grid.ResetStats();
+      printf("grid auto tuning: %s\n", auto_tune_grid ? "on" : "off");
+    }
+    if (input::Handler::GetKeyPressed(SDL_SCANCODE_F5)) {
+      morton_sort_enabled = !morton_sort_enabled;
+      printf("morton sort: %s\n", morton_sort_enabled ? "on" : "off");
+    }
+    if (input::Handler::GetKeyPressed(SDL_SCANCODE_F7)) {
+      parallel_systems = !parallel_systems;
+      printf("system threads: %d\n",
+             parallel_systems ? system_pool.GetThreadCount() : 1);
+    }
+    const bool print_timeline =
+        input::Handler::GetKeyPressed(SDL_SCANCODE_F8);
 
-    float delta_time = GetUpdatedTimeDelta(previous_time);
-    HandlePlayerLogic((float)delta_time);
-
-    const auto enemies = GetActiveEntities(entity::Type::kEnemy);
-    UpdateEnemyVelocities(enemies, &position_components[0]);
-
-    const auto enemies_inside_view =
-        GetActiveEntitiesInsideView(entity::Type::kEnemy);
-    AngleTowardsVelocity(enemies_inside_view);
-
-    AddVelocitiesToPositions((float)delta_time, previous_active_positions);
-    UpdateCollisionGrid(enemies_inside_view, previous_active_positions);
-    HandleCollisions();
-
-    FlagStrayBullets();
-    RemoveDeadEntities();
+    // the player is kept by handle, which goes stale once it is destroyed
+    if (!entity_allocator.Resolve(player_handle, player)) {
+      is_running = false;
+      break;
+    }
+    delta_time = GetUpdatedTimeDelta(previous_time);
+    if (parallel_systems) {
+      scheduler.Run(system_pool);
+    } else {
+      scheduler.Run();
+    }
+    if (print_timeline) {
+      scheduler.PrintTimeline();
+    }
+    static int frames_since_sort = 0;
+    if (morton_sort_enabled && ++frames_since_sort >= morton_sort_interval) {
+      frames_since_sort = 0;
+      SortEntitiesInMortonOrder();
+    }
 
-    RenderGame(app, render_data_components, background_texture, render_texture);
+    RenderGame(app, background_texture, render_texture);
 
     PrintFPS(previous_time);
   }